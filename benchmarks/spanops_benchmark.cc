@@ -0,0 +1,298 @@
+// Google Benchmark suite for the core SpanSet operations.
+//
+// Every benchmark runs over the same synthetic masks (see Workload), at two
+// image sizes, so results can be compared across operations as well as
+// between versions.  Run with
+//
+//     spanops_benchmark --benchmark_out=results.json --benchmark_out_format=json
+//
+// (or 'make benchmark_json') and compare two result files with Google
+// Benchmark's tools/compare.py.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "spanops.h"
+
+namespace spanops {
+namespace {
+
+enum Workload {
+    BLOBS,          // a few thousand small random disks
+    STRIPES,        // vertical stripes: many short spans in every row
+    CHECKERBOARD,   // 2x2 cells: the most spans an image of this size can have
+    GIANT,          // one disk filling most of the image
+    N_WORKLOADS
+};
+
+char const * const workload_names[N_WORKLOADS] = {"blobs", "stripes", "checkerboard", "giant"};
+
+// A size x size mask for the given workload.  'phase' varies the random seed
+// and shifts the regular patterns, so two masks with different phases
+// overlap partially.
+std::vector<std::uint8_t> make_mask(Workload workload, int size, int phase) {
+    std::vector<std::uint8_t> mask(std::size_t(size)*size, 0u);
+    auto disk = [&](int cx, int cy, int r) {
+        for (int y = std::max(cy - r, 0); y <= std::min(cy + r, size - 1); ++y) {
+            int const half = static_cast<int>(std::sqrt(double(r)*r - double(y - cy)*(y - cy)));
+            for (int x = std::max(cx - half, 0); x <= std::min(cx + half, size - 1); ++x) {
+                mask[std::size_t(y)*size + x] = 1u;
+            }
+        }
+    };
+    switch (workload) {
+    case BLOBS: {
+        std::mt19937 rng(1234 + phase);
+        std::uniform_int_distribution<int> position(0, size - 1);
+        std::uniform_int_distribution<int> radius(2, 12);
+        for (int n = 0; n < size*size/2000; ++n) {
+            disk(position(rng), position(rng), radius(rng));
+        }
+        break;
+    }
+    case STRIPES:
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                mask[std::size_t(y)*size + x] = ((x + phase) % 7) < 3;
+            }
+        }
+        break;
+    case CHECKERBOARD:
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                mask[std::size_t(y)*size + x] = (((x + phase)/2 + (y + phase)/2) % 2) == 0;
+            }
+        }
+        break;
+    case GIANT:
+        disk(size/2 + phase, size/2, size*9/20);
+        break;
+    default:
+        break;
+    }
+    return mask;
+}
+
+Box image_box(int size) {
+    return Box(Interval(0, size - 1), Interval(0, size - 1));
+}
+
+SpanSet make_span_set(Workload workload, int size, int phase) {
+    std::vector<std::uint8_t> mask = make_mask(workload, size, phase);
+    ImageWrapper<std::uint8_t const> image{mask.data(), size, image_box(size)};
+    return SpanSet::extract(image, std::uint8_t(1));
+}
+
+Workload workload_arg(benchmark::State & state) {
+    Workload const workload = static_cast<Workload>(state.range(0));
+    state.SetLabel(workload_names[workload]);
+    return workload;
+}
+
+void workload_args(benchmark::internal::Benchmark * b) {
+    b->ArgNames({"workload", "size"});
+    for (int w = 0; w < N_WORKLOADS; ++w) {
+        for (int size : {512, 2048}) {
+            b->Args({w, size});
+        }
+    }
+    b->Unit(benchmark::kMicrosecond);
+}
+
+template <typename T>
+void BM_extract(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    std::vector<std::uint8_t> const mask = make_mask(workload, size, 0);
+    std::unique_ptr<T[]> pixels(new T[mask.size()]);
+    for (std::size_t i = 0; i < mask.size(); ++i) {
+        pixels[i] = static_cast<T>(mask[i]);
+    }
+    ImageWrapper<T const> image{pixels.get(), size, image_box(size)};
+    for (auto _ : state) {
+        SpanSet result = SpanSet::extract(image, static_cast<T>(1));
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(mask.size()));
+}
+
+BENCHMARK_TEMPLATE(BM_extract, bool)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::uint8_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::int8_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::uint16_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::int16_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::uint32_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::int32_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::uint64_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, std::int64_t)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, float)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_extract, double)->Apply(workload_args);
+
+void BM_insert(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const spans = make_span_set(workload, size, 0);
+    std::vector<float> pixels(std::size_t(size)*size, 0.0f);
+    ImageWrapper<float> image{pixels.data(), size, image_box(size)};
+    for (auto _ : state) {
+        spans.insert(image, 1.0f);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(spans.area()));
+}
+
+BENCHMARK(BM_insert)->Apply(workload_args);
+
+void BM_union(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const a = make_span_set(workload, size, 0);
+    SpanSet const b = make_span_set(workload, size, 1);
+    for (auto _ : state) {
+        SpanSet result = a | b;
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(a.size() + b.size()));
+}
+
+BENCHMARK(BM_union)->Apply(workload_args);
+
+void BM_intersection(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const a = make_span_set(workload, size, 0);
+    SpanSet const b = make_span_set(workload, size, 1);
+    for (auto _ : state) {
+        SpanSet result = a & b;
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(a.size() + b.size()));
+}
+
+BENCHMARK(BM_intersection)->Apply(workload_args);
+
+void BM_split(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const spans = make_span_set(workload, size, 0);
+    for (auto _ : state) {
+        std::vector<SpanSet> result = spans.split();
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(spans.size()));
+}
+
+BENCHMARK(BM_split)->Apply(workload_args);
+
+void BM_split_collection(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const spans = make_span_set(workload, size, 0);
+    for (auto _ : state) {
+        SpanSetCollection result = spans.split_collection();
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(spans.size()));
+}
+
+BENCHMARK(BM_split_collection)->Apply(workload_args);
+
+void BM_extract_split(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    std::vector<std::uint8_t> const mask = make_mask(workload, size, 0);
+    ImageWrapper<std::uint8_t const> image{mask.data(), size, image_box(size)};
+    for (auto _ : state) {
+        std::vector<SpanSet> result = SpanSet::extract(image, std::uint8_t(1)).split();
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(mask.size()));
+}
+
+BENCHMARK(BM_extract_split)->Apply(workload_args);
+
+void BM_extract_components(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    std::vector<std::uint8_t> const mask = make_mask(workload, size, 0);
+    ImageWrapper<std::uint8_t const> image{mask.data(), size, image_box(size)};
+    for (auto _ : state) {
+        std::vector<SpanSet> result = SpanSet::extract_components(image, std::uint8_t(1));
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(mask.size()));
+}
+
+BENCHMARK(BM_extract_components)->Apply(workload_args);
+
+void BM_bbox(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const spans = make_span_set(workload, size, 0);
+    for (auto _ : state) {
+        Box result = spans.bbox();
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(spans.size()));
+}
+
+BENCHMARK(BM_bbox)->Apply(workload_args);
+
+void BM_area(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const spans = make_span_set(workload, size, 0);
+    for (auto _ : state) {
+        int result = spans.area();
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(spans.size()));
+}
+
+BENCHMARK(BM_area)->Apply(workload_args);
+
+template <bool sorted>
+void BM_contains(benchmark::State & state) {
+    Workload const workload = workload_arg(state);
+    int const size = static_cast<int>(state.range(1));
+    SpanSet const spans = make_span_set(workload, size, 0);
+    std::size_t const n = 1000000;
+    std::vector<int> xs(n), ys(n);
+    std::mt19937 rng(5678);
+    std::uniform_int_distribution<int> position(0, size - 1);
+    for (std::size_t i = 0; i < n; ++i) {
+        xs[i] = position(rng);
+        ys[i] = position(rng);
+    }
+    if (sorted) {
+        std::sort(ys.begin(), ys.end());
+        for (std::size_t first = 0; first < n;) {
+            std::size_t last = first;
+            while (last < n && ys[last] == ys[first]) {
+                ++last;
+            }
+            std::sort(xs.begin() + first, xs.begin() + last);
+            first = last;
+        }
+    }
+    std::unique_ptr<bool[]> result(new bool[n]);
+    for (auto _ : state) {
+        spans.contains(xs.data(), ys.data(), n, result.get());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*std::int64_t(n));
+}
+
+BENCHMARK_TEMPLATE(BM_contains, false)->Apply(workload_args);
+BENCHMARK_TEMPLATE(BM_contains, true)->Apply(workload_args);
+
+} // anonymous
+} // namespace spanops
+
+BENCHMARK_MAIN();
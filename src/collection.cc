@@ -0,0 +1,38 @@
+#include "spanops.h"
+#include "parallel.h"
+
+namespace spanops {
+
+int SpanSetCollection::View::area() const {
+    int a = 0;
+    for (auto const & span : *this) {
+        a += span.width();
+    }
+    return a;
+}
+
+Box SpanSetCollection::View::bbox() const {
+    Box box;
+    for (auto const & span : *this) {
+        box.expand_to(span);
+    }
+    return box;
+}
+
+SpanSet SpanSetCollection::View::to_span_set() const {
+    return SpanSet(std::vector<Span>(_begin, _end));
+}
+
+std::vector<SpanSet> SpanSetCollection::to_span_sets(int threads) const {
+    threads = detail::resolve_threads(threads);
+    std::vector<SpanSet> result(size());
+    std::vector<std::size_t> chunks = detail::even_chunks(result.size(), threads);
+    detail::parallel_for(chunks.size() - 1, threads, [&](std::size_t c) {
+        for (std::size_t n = chunks[c]; n < chunks[c + 1]; ++n) {
+            result[n] = (*this)[n].to_span_set();
+        }
+    });
+    return result;
+}
+
+} // namespace spanops
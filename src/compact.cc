@@ -0,0 +1,209 @@
+#include <algorithm>
+
+#include "spanops.h"
+#include "components.h"
+#include "parallel.h"
+#include "runs.h"
+
+namespace spanops {
+
+CompactSpanSet::CompactSpanSet(SpanSet const & spans) : CompactSpanSet() {
+    if (spans.empty()) {
+        return;
+    }
+    _x0.reserve(spans.size());
+    _x1.reserve(spans.size());
+    _offsets.reserve(spans.bbox().height() + 1);
+    for (auto const & span : spans) {
+        append(span.y(), span.x0(), span.x1());
+    }
+}
+
+SpanSet CompactSpanSet::to_span_set() const {
+    std::vector<Span> spans;
+    spans.reserve(size());
+    for (std::size_t r = 0; r + 1 < _offsets.size(); ++r) {
+        for (std::size_t i = _offsets[r]; i < _offsets[r + 1]; ++i) {
+            spans.emplace_back(Interval(_x0[i], _x1[i]), _y0 + static_cast<int>(r));
+        }
+    }
+    return SpanSet::from_spans(std::move(spans));
+}
+
+int CompactSpanSet::area() const {
+    int a = 0;
+    for (std::size_t i = 0; i < size(); ++i) {
+        a += 1 + _x1[i] - _x0[i];
+    }
+    return a;
+}
+
+Box CompactSpanSet::bbox() const {
+    if (empty()) {
+        return Box();
+    }
+    return Box(Interval(*std::min_element(_x0.begin(), _x0.end()),
+                        *std::max_element(_x1.begin(), _x1.end())),
+               rows());
+}
+
+std::size_t CompactSpanSet::row_begin(int y) const {
+    if (!rows().overlaps(y)) {
+        return y < _y0 ? 0 : size();
+    }
+    return _offsets[y - _y0];
+}
+
+std::size_t CompactSpanSet::row_size(int y) const {
+    if (!rows().overlaps(y)) {
+        return 0;
+    }
+    return _offsets[y - _y0 + 1] - _offsets[y - _y0];
+}
+
+void CompactSpanSet::append(int y, int x0, int x1) {
+    if (empty()) {
+        _y0 = y;
+        _offsets.assign(2, 0u);
+    }
+    while (rows().max() < y) {
+        _offsets.push_back(_offsets.back());
+    }
+    _x0.push_back(x0);
+    _x1.push_back(x1);
+    ++_offsets.back();
+}
+
+void CompactSpanSet::trim() {
+    while (_offsets.size() > 1 && _offsets[_offsets.size() - 2] == _offsets.back()) {
+        _offsets.pop_back();
+    }
+    if (_offsets.size() == 1) {
+        _y0 = 0;
+    }
+}
+
+CompactSpanSet CompactSpanSet::operator&(CompactSpanSet const & other) const {
+    CompactSpanSet result;
+    Interval const overlap = rows() & other.rows();
+    for (int y = overlap.min(); y <= overlap.max(); ++y) {
+        // Two-pointer sweep over the two rows, found directly by index.
+        int const * a0 = row_x0(y);
+        int const * a1 = row_x1(y);
+        int const * const a_end = a0 + row_size(y);
+        int const * b0 = other.row_x0(y);
+        int const * b1 = other.row_x1(y);
+        int const * const b_end = b0 + other.row_size(y);
+        while (a0 != a_end && b0 != b_end) {
+            int const x0 = std::max(*a0, *b0);
+            int const x1 = std::min(*a1, *b1);
+            if (x0 <= x1) {
+                result.append(y, x0, x1);
+            }
+            if (*a1 < *b1) {
+                ++a0;
+                ++a1;
+            } else {
+                ++b0;
+                ++b1;
+            }
+        }
+    }
+    result.trim();
+    return result;
+}
+
+bool CompactSpanSet::operator==(CompactSpanSet const & other) const {
+    return _x0 == other._x0 && _x1 == other._x1 &&
+        (empty() || (_y0 == other._y0 && _offsets == other._offsets));
+}
+
+template <typename T>
+void CompactSpanSet::insert(ImageWrapper<T> const & image, T value, InsertMode mode,
+                            int threads) const {
+    mode = detail::resolve_insert_mode<T>(mode);
+    Interval const overlap = rows() & image.bbox.y();
+    if (overlap.empty() || image.bbox.x().empty()) {
+        return;
+    }
+    detail::InsertFunction<T> const kernel = detail::insert_kernel<T>();
+    threads = detail::resolve_threads(threads);
+    // Each row's spans are found by index, so bands of rows can be handed
+    // out without looking at the spans first.
+    std::vector<std::size_t> bands = detail::even_chunks(overlap.length(), threads);
+    detail::parallel_for(bands.size() - 1, threads, [&](std::size_t b) {
+        int const y_end = overlap.min() + static_cast<int>(bands[b + 1]);
+        for (int y = overlap.min() + static_cast<int>(bands[b]); y < y_end; ++y) {
+            T * row = image.ptr + image.stride*(y - image.bbox.y0());
+            int const * x0 = row_x0(y);
+            int const * x1 = row_x1(y);
+            for (std::size_t n = row_size(y); n > 0; --n, ++x0, ++x1) {
+                Interval x_intersection = Interval(*x0, *x1) & image.bbox.x();
+                if (x_intersection.empty()) {
+                    continue;
+                }
+                detail::insert_span(row + x_intersection.min() - image.bbox.x0(),
+                                    x_intersection.length(), value, mode, kernel);
+            }
+        }
+    });
+}
+
+namespace {
+
+class CompactRuns {
+public:
+    CompactRuns(int const * x0, int const * x1) : _x0(x0), _x1(x1) {}
+    int x0(std::size_t i) const { return _x0[i]; }
+    int x1(std::size_t i) const { return _x1[i]; }
+private:
+    int const * _x0;
+    int const * _x1;
+};
+
+} // anonymous
+
+std::vector<CompactSpanSet> CompactSpanSet::split(Connectivity connectivity) const {
+    // Consecutive entries in _offsets are consecutive rows, so finding each
+    // row's neighbour takes no searching at all.
+    detail::UnionFind sets(size());
+    CompactRuns const runs(_x0.data(), _x1.data());
+    for (std::size_t r = 0; r + 1 < _offsets.size(); ++r) {
+        detail::unite_within_row(runs, _offsets[r], _offsets[r + 1], sets);
+        if (r > 0) {
+            detail::unite_adjacent_rows(runs, _offsets[r - 1], _offsets[r],
+                                        _offsets[r], _offsets[r + 1], connectivity, sets);
+        }
+    }
+    std::size_t const unlabeled = static_cast<std::size_t>(-1);
+    std::vector<std::size_t> root_labels(size(), unlabeled);
+    std::vector<CompactSpanSet> result;
+    for (std::size_t r = 0; r + 1 < _offsets.size(); ++r) {
+        for (std::size_t i = _offsets[r]; i < _offsets[r + 1]; ++i) {
+            std::size_t & label = root_labels[sets.find(i)];
+            if (label == unlabeled) {
+                label = result.size();
+                result.emplace_back();
+            }
+            result[label].append(_y0 + static_cast<int>(r), _x0[i], _x1[i]);
+        }
+    }
+    return result;
+}
+
+#define INSTANTIATE(T) \
+    template void CompactSpanSet::insert(ImageWrapper<T> const &, T, InsertMode, int) const
+
+INSTANTIATE(bool);
+INSTANTIATE(std::uint8_t);
+INSTANTIATE(std::int8_t);
+INSTANTIATE(std::uint16_t);
+INSTANTIATE(std::int16_t);
+INSTANTIATE(std::uint32_t);
+INSTANTIATE(std::int32_t);
+INSTANTIATE(std::uint64_t);
+INSTANTIATE(std::int64_t);
+INSTANTIATE(float);
+INSTANTIATE(double);
+
+} // namespace spanops
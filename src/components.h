@@ -0,0 +1,137 @@
+#ifndef SPANOPS_COMPONENTS_H_INCLUDED
+#define SPANOPS_COMPONENTS_H_INCLUDED
+
+// Connected-component labeling helpers shared by the span containers.
+//
+// Spans are identified by index; the templates below take any 'Runs' type
+// with x0(i) and x1(i) accessors, so they work on both vectors of Spans and
+// the structure-of-arrays layout of CompactSpanSet.
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "spanops.h"
+
+namespace spanops {
+namespace detail {
+
+// Disjoint-set forest over span indices, with union by rank and path halving.
+class UnionFind {
+public:
+
+    explicit UnionFind(std::size_t n) : _parent(n), _rank(n, 0) {
+        for (std::size_t i = 0; i < n; ++i) {
+            _parent[i] = i;
+        }
+    }
+
+    // Extend to n elements, adding each new one as a singleton set.
+    void grow(std::size_t n) {
+        for (std::size_t i = _parent.size(); i < n; ++i) {
+            _parent.push_back(i);
+        }
+        _rank.resize(n, 0);
+    }
+
+    std::size_t find(std::size_t i) {
+        while (_parent[i] != i) {
+            _parent[i] = _parent[_parent[i]];
+            i = _parent[i];
+        }
+        return i;
+    }
+
+    // Like find, but without path compression, so it's safe to call
+    // concurrently once all unions are done.
+    std::size_t root(std::size_t i) const {
+        while (_parent[i] != i) {
+            i = _parent[i];
+        }
+        return i;
+    }
+
+    void unite(std::size_t a, std::size_t b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return;
+        if (_rank[a] < _rank[b]) {
+            std::swap(a, b);
+        }
+        _parent[b] = a;
+        if (_rank[a] == _rank[b]) {
+            ++_rank[a];
+        }
+    }
+
+private:
+    std::vector<std::size_t> _parent;
+    std::vector<unsigned char> _rank;
+};
+
+// Runs accessor for a vector of Spans.
+class SpanRuns {
+public:
+    explicit SpanRuns(std::vector<Span> const & spans) : _spans(spans) {}
+    int x0(std::size_t i) const { return _spans[i].x0(); }
+    int x1(std::size_t i) const { return _spans[i].x1(); }
+private:
+    std::vector<Span> const & _spans;
+};
+
+// Unite the spans in [first, last), which are all in one row, that abut.
+template <typename Runs>
+void unite_within_row(Runs const & runs, std::size_t first, std::size_t last, UnionFind & sets) {
+    for (std::size_t k = first + 1; k < last; ++k) {
+        if (runs.x0(k) <= runs.x1(k - 1) + 1) {
+            sets.unite(k - 1, k);
+        }
+    }
+}
+
+// Unite the spans in [prev_first, prev_last) with the spans they touch in
+// [first, last), which must be in the next row.  Both rows are swept
+// together, so this is linear in the number of spans in them.
+template <typename Runs>
+void unite_adjacent_rows(
+    Runs const & runs,
+    std::size_t prev_first, std::size_t prev_last,
+    std::size_t first, std::size_t last,
+    Connectivity connectivity,
+    UnionFind & sets
+) {
+    // Spans in adjacent rows touch if their x ranges overlap, or (for
+    // 8-connectivity) are separated by nothing but a diagonal step.
+    int const slack = (connectivity == Connectivity::EIGHT) ? 1 : 0;
+    std::size_t j = first;
+    for (std::size_t i = prev_first; i < prev_last; ++i) {
+        while (j < last && runs.x1(j) + slack < runs.x0(i)) {
+            ++j;
+        }
+        for (std::size_t k = j; k < last && runs.x0(k) <= runs.x1(i) + slack; ++k) {
+            sets.unite(i, k);
+        }
+    }
+}
+
+// Replace each element of 'roots', the root of each span's set, with the
+// index of its component, numbering components in the order of their first
+// span; return the number of components.
+inline std::size_t number_components(std::vector<std::size_t> & roots) {
+    std::size_t const unlabeled = static_cast<std::size_t>(-1);
+    std::vector<std::size_t> root_labels(roots.size(), unlabeled);
+    std::size_t n = 0;
+    for (auto & root : roots) {
+        std::size_t & label = root_labels[root];
+        if (label == unlabeled) {
+            label = n++;
+        }
+        root = label;
+    }
+    return n;
+}
+
+} // namespace detail
+} // namespace spanops
+
+#endif // !SPANOPS_COMPONENTS_H_INCLUDED
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <limits>
+
+#include "spanops.h"
+#include "stats.h"
+
+namespace spanops {
+
+struct SpanSetExpression::Node {
+    Op op;
+    SpanSet const * operand;
+    std::shared_ptr<Node const> left;
+    std::shared_ptr<Node const> right;
+};
+
+SpanSetExpression::SpanSetExpression(SpanSet const & operand) :
+    _node(std::make_shared<Node>(Node{Op::OPERAND, &operand, nullptr, nullptr}))
+{}
+
+SpanSetExpression::SpanSetExpression(Op op, SpanSetExpression const & a, SpanSetExpression const & b) :
+    _node(std::make_shared<Node>(Node{op, nullptr, a._node, b._node}))
+{}
+
+SpanSetExpression operator|(SpanSetExpression const & a, SpanSetExpression const & b) {
+    return SpanSetExpression(SpanSetExpression::Op::UNION, a, b);
+}
+
+SpanSetExpression operator&(SpanSetExpression const & a, SpanSetExpression const & b) {
+    return SpanSetExpression(SpanSetExpression::Op::INTERSECTION, a, b);
+}
+
+SpanSetExpression operator-(SpanSetExpression const & a, SpanSetExpression const & b) {
+    return SpanSetExpression(SpanSetExpression::Op::DIFFERENCE, a, b);
+}
+
+SpanSetExpression operator^(SpanSetExpression const & a, SpanSetExpression const & b) {
+    return SpanSetExpression(SpanSetExpression::Op::SYMMETRIC_DIFFERENCE, a, b);
+}
+
+namespace {
+
+// An expression flattened into postfix order over a list of distinct
+// operands, for evaluating pointwise: given whether a pixel is in each
+// operand, is it in the result?
+template <typename Op>
+class Program {
+public:
+
+    struct Instruction {
+        Op op;
+        std::size_t operand;
+    };
+
+    template <typename Node>
+    explicit Program(Node const & root) {
+        // Iterative post-order traversal, since long chains built in a loop
+        // can be deep.
+        std::vector<std::pair<Node const *, bool>> stack = {{&root, false}};
+        while (!stack.empty()) {
+            Node const * node = stack.back().first;
+            bool const visited = stack.back().second;
+            stack.pop_back();
+            if (node->op == Op::OPERAND) {
+                auto iter = std::find(operands.begin(), operands.end(), node->operand);
+                _code.push_back({Op::OPERAND, std::size_t(iter - operands.begin())});
+                if (iter == operands.end()) {
+                    operands.push_back(node->operand);
+                }
+            } else if (visited) {
+                _code.push_back({node->op, 0});
+            } else {
+                stack.emplace_back(node, true);
+                stack.emplace_back(node->right.get(), false);
+                stack.emplace_back(node->left.get(), false);
+            }
+        }
+    }
+
+    // 'inside[i]' is whether the pixel is in operands[i].
+    bool operator()(char const * inside) const {
+        _stack.clear();
+        for (auto const & instruction : _code) {
+            if (instruction.op == Op::OPERAND) {
+                _stack.push_back(inside[instruction.operand]);
+                continue;
+            }
+            char const b = _stack.back();
+            _stack.pop_back();
+            char & a = _stack.back();
+            switch (instruction.op) {
+            case Op::UNION:
+                a = a | b;
+                break;
+            case Op::INTERSECTION:
+                a = a & b;
+                break;
+            case Op::DIFFERENCE:
+                a = a & !b;
+                break;
+            case Op::SYMMETRIC_DIFFERENCE:
+                a = a ^ b;
+                break;
+            default:
+                break;
+            }
+        }
+        return _stack.back() != 0;
+    }
+
+    std::vector<SpanSet const *> operands;
+
+private:
+    std::vector<Instruction> _code;
+    mutable std::vector<char> _stack;
+};
+
+// Expressions with at most this many distinct operands are evaluated with a
+// lookup table indexed by a bitmask of the operands a pixel is in.
+constexpr std::size_t max_table_operands = 12;
+
+} // anonymous
+
+SpanSet SpanSetExpression::evaluate() const {
+    detail::OperationTimer timer(Operation::EVALUATE);
+    Program<Op> const program(*_node);
+    std::size_t const n = program.operands.size();
+    std::vector<char> table;
+    if (n <= max_table_operands) {
+        table.resize(std::size_t(1) << n);
+        std::vector<char> inside(n);
+        for (std::size_t mask = 0; mask < table.size(); ++mask) {
+            for (std::size_t i = 0; i < n; ++i) {
+                inside[i] = (mask >> i) & 1u;
+            }
+            table[mask] = program(inside.data());
+        }
+    }
+    std::vector<SpanSet::iterator> next;
+    std::vector<SpanSet::iterator> end;
+    for (auto operand : program.operands) {
+        timer.spans_in(operand->size());
+        next.push_back(operand->begin());
+        end.push_back(operand->end());
+    }
+    // Each row is a sweep over the boundaries of the operands' spans in that
+    // row, as 64-bit keys that sort by x, then by operand, then ends before
+    // starts (so spans in one operand that touch don't split the result).
+    // The x of an end is one past the span, so it needs 33 bits.
+    std::vector<std::uint64_t> events;
+    std::vector<char> inside(n, 0);
+    std::size_t mask = 0;
+    std::vector<Span> spans;
+    auto boundary = [](std::int64_t x, std::size_t operand, bool start) {
+        std::uint64_t const ux = static_cast<std::uint64_t>(x - std::numeric_limits<int>::min());
+        return (ux << 31) | (std::uint64_t(operand) << 1) | std::uint64_t(start);
+    };
+    while (true) {
+        bool any = false;
+        int y = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (next[i] != end[i] && (!any || next[i]->y() < y)) {
+                y = next[i]->y();
+                any = true;
+            }
+        }
+        if (!any) {
+            break;
+        }
+        events.clear();
+        for (std::size_t i = 0; i < n; ++i) {
+            for (; next[i] != end[i] && next[i]->y() == y; ++next[i]) {
+                events.push_back(boundary(next[i]->x0(), i, true));
+                events.push_back(boundary(std::int64_t(next[i]->x1()) + 1, i, false));
+            }
+        }
+        std::sort(events.begin(), events.end());
+        bool in_result = false;
+        int start = 0;
+        for (std::size_t e = 0; e < events.size();) {
+            std::uint64_t const x_bits = events[e] >> 31;
+            for (; e < events.size() && (events[e] >> 31) == x_bits; ++e) {
+                std::size_t const i = (events[e] & 0x7fffffffu) >> 1;
+                bool const is_start = events[e] & 1u;
+                inside[i] = is_start;
+                if (n <= max_table_operands) {
+                    mask = is_start ? (mask | (std::size_t(1) << i)) : (mask & ~(std::size_t(1) << i));
+                }
+            }
+            bool const value = (n <= max_table_operands) ? table[mask] != 0 : program(inside.data());
+            if (value != in_result) {
+                std::int64_t const x = static_cast<std::int64_t>(x_bits) + std::numeric_limits<int>::min();
+                if (value) {
+                    start = static_cast<int>(x);
+                } else {
+                    spans.emplace_back(Interval(start, static_cast<int>(x - 1)), y);
+                }
+                in_result = value;
+            }
+        }
+    }
+    timer.output(spans);
+    return SpanSet::from_spans(std::move(spans));
+}
+
+} // namespace spanops
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "spanops.h"
+#include "parallel.h"
+
+namespace spanops {
+
+namespace {
+
+// Sort-tile-recursive ordering of 'boxes': return a permutation that groups
+// them into slices by center x, each sorted by center y, so that runs of
+// 'node_size' consecutive boxes are spatially compact.
+std::vector<std::uint32_t> str_order(std::vector<Box> const & boxes, std::size_t node_size) {
+    std::size_t const n = boxes.size();
+    std::vector<std::uint32_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+    // Centers are compared doubled, to stay in integers.
+    auto center_x = [&boxes](std::uint32_t i) {
+        return static_cast<long long>(boxes[i].x0()) + boxes[i].x1();
+    };
+    auto center_y = [&boxes](std::uint32_t i) {
+        return static_cast<long long>(boxes[i].y0()) + boxes[i].y1();
+    };
+    std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return center_x(a) < center_x(b);
+    });
+    std::size_t const nodes = (n + node_size - 1)/node_size;
+    std::size_t const slices = static_cast<std::size_t>(std::ceil(std::sqrt(double(nodes))));
+    std::size_t const slice_size = node_size*((nodes + slices - 1)/std::max<std::size_t>(slices, 1));
+    for (std::size_t first = 0; first < n; first += slice_size) {
+        std::size_t const last = std::min(n, first + slice_size);
+        std::sort(order.begin() + first, order.begin() + last, [&](std::uint32_t a, std::uint32_t b) {
+            return center_y(a) < center_y(b);
+        });
+    }
+    return order;
+}
+
+} // anonymous
+
+SpanSetIndex::SpanSetIndex(std::vector<SpanSet> sets, int node_size) :
+    _sets(std::move(sets)), _boxes(), _entries(), _levels()
+{
+    if (node_size < 2) {
+        throw std::invalid_argument("SpanSetIndex node size must be at least 2");
+    }
+    _boxes.reserve(_sets.size());
+    for (auto const & set : _sets) {
+        _boxes.push_back(set.bbox());
+    }
+    // Empty SpanSets never match anything, so they're left out of the tree.
+    std::vector<Box> boxes;
+    std::vector<std::uint32_t> indices;
+    for (std::size_t i = 0; i < _sets.size(); ++i) {
+        if (!_sets[i].empty()) {
+            boxes.push_back(_boxes[i]);
+            indices.push_back(static_cast<std::uint32_t>(i));
+        }
+    }
+    std::vector<std::uint32_t> order = str_order(boxes, node_size);
+    _entries.reserve(order.size());
+    for (auto i : order) {
+        _entries.push_back(indices[i]);
+    }
+    // Group consecutive children into nodes, then reorder the nodes for the
+    // level above, until a single root is left.
+    std::vector<Box> children;
+    for (auto i : _entries) {
+        children.push_back(_boxes[i]);
+    }
+    while (!children.empty()) {
+        std::vector<Node> level;
+        for (std::size_t first = 0; first < children.size(); first += node_size) {
+            std::size_t const last = std::min(children.size(), first + node_size);
+            Node node = {Box(), static_cast<std::uint32_t>(first), static_cast<std::uint32_t>(last)};
+            for (std::size_t c = first; c < last; ++c) {
+                node.bbox.expand_to(children[c]);
+            }
+            level.push_back(node);
+        }
+        if (level.size() > 1) {
+            children.clear();
+            for (auto const & node : level) {
+                children.push_back(node.bbox);
+            }
+            std::vector<std::uint32_t> order = str_order(children, node_size);
+            std::vector<Node> sorted;
+            sorted.reserve(level.size());
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                sorted.push_back(level[order[i]]);
+                children[i] = sorted.back().bbox;
+            }
+            level.swap(sorted);
+        } else {
+            children.clear();
+        }
+        _levels.push_back(std::move(level));
+    }
+}
+
+template <typename Visitor>
+void SpanSetIndex::search(Box const & box, Visitor && visit) const {
+    if (_levels.empty() || box.empty()) {
+        return;
+    }
+    // Depth-first, with (level, node) pairs on an explicit stack.
+    std::vector<std::pair<std::size_t, std::uint32_t>> stack;
+    std::size_t const top = _levels.size() - 1;
+    for (std::uint32_t n = 0; n < _levels[top].size(); ++n) {
+        stack.emplace_back(top, n);
+    }
+    while (!stack.empty()) {
+        std::size_t const level = stack.back().first;
+        Node const & node = _levels[level][stack.back().second];
+        stack.pop_back();
+        if (!node.bbox.overlaps(box)) {
+            continue;
+        }
+        if (level == 0) {
+            for (std::uint32_t e = node.first; e < node.last; ++e) {
+                if (_boxes[_entries[e]].overlaps(box)) {
+                    visit(_entries[e]);
+                }
+            }
+        } else {
+            for (std::uint32_t c = node.first; c < node.last; ++c) {
+                stack.emplace_back(level - 1, c);
+            }
+        }
+    }
+}
+
+std::vector<std::size_t> SpanSetIndex::query(Box const & box) const {
+    std::vector<std::size_t> result;
+    search(box, [&](std::size_t i) {
+        if (_sets[i].overlaps(box)) {
+            result.push_back(i);
+        }
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<std::size_t> SpanSetIndex::query(int x, int y) const {
+    std::vector<std::size_t> result;
+    search(Box(Interval(x), Interval(y)), [&](std::size_t i) {
+        if (_sets[i].contains(x, y)) {
+            result.push_back(i);
+        }
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<std::pair<std::size_t, std::size_t>> SpanSetIndex::overlapping_pairs(int threads) const {
+    using Pairs = std::vector<std::pair<std::size_t, std::size_t>>;
+    threads = detail::resolve_threads(threads);
+    std::vector<std::size_t> chunks = detail::even_chunks(size(), 4*threads);
+    std::vector<Pairs> found(chunks.size() - 1);
+    detail::parallel_for(found.size(), threads, [&](std::size_t c) {
+        Pairs & pairs = found[c];
+        std::vector<std::size_t> partners;
+        for (std::size_t i = chunks[c]; i < chunks[c + 1]; ++i) {
+            if (_sets[i].empty()) {
+                continue;
+            }
+            partners.clear();
+            search(_boxes[i], [&](std::size_t j) {
+                if (j > i && _sets[i].overlaps(_sets[j])) {
+                    partners.push_back(j);
+                }
+            });
+            std::sort(partners.begin(), partners.end());
+            for (auto j : partners) {
+                pairs.emplace_back(i, j);
+            }
+        }
+    });
+    Pairs result;
+    for (auto & pairs : found) {
+        result.insert(result.end(), pairs.begin(), pairs.end());
+    }
+    return result;
+}
+
+} // namespace spanops
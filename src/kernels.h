@@ -0,0 +1,419 @@
+#ifndef SPANOPS_KERNELS_H_INCLUDED
+#define SPANOPS_KERNELS_H_INCLUDED
+
+// Definitions of the SpanSet and StreamingExtractor member templates that
+// read or write images.
+//
+// The library instantiates these for the pixel types and predicates in
+// spanops.h.  Including this header makes them available for other types as
+// well (e.g. a custom predicate for extract_if, or char or long double
+// images), and lets the compiler inline them at the call site.  Pixel types
+// and predicates the library doesn't instantiate use the scalar loops rather
+// than the vectorized kernels (see runs.h).
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "spanops.h"
+#include "components.h"
+#include "parallel.h"
+#include "runs.h"
+#include "stats.h"
+
+namespace spanops {
+
+namespace detail {
+
+// Divide spans [first, last) into up to 'parts' bands of whole rows with
+// roughly the same number of spans, returned as band boundaries.
+inline std::vector<std::size_t> row_bands(
+    std::vector<Span> const & spans, std::size_t first, std::size_t last, std::size_t parts
+) {
+    std::vector<std::size_t> bounds = even_chunks(last - first, parts);
+    for (auto & b : bounds) {
+        b += first;
+    }
+    for (std::size_t i = 1; i + 1 < bounds.size(); ++i) {
+        std::size_t & b = bounds[i];
+        b = std::max(b, bounds[i - 1]);
+        while (b > bounds[i - 1] && b < last && spans[b].y() == spans[b - 1].y()) {
+            ++b;
+        }
+    }
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    return bounds;
+}
+
+// Running sums over the covered pixels.  Coordinates are relative to a
+// reference point near the SpanSet, so the second moments don't lose
+// precision when it's far from the image origin.
+template <typename T>
+class Accumulator {
+public:
+
+    Accumulator(int ref_x, int ref_y) :
+        _ref_x(ref_x), _ref_y(ref_y), _count(0), _min(), _max(),
+        _s(0.0), _sx(0.0), _sy(0.0), _sxx(0.0), _sxy(0.0), _syy(0.0)
+    {}
+
+    // Add the n pixels starting at p, the first of which is at (x, y).
+    void add(T const * p, int n, int x, int y) {
+        // Sums of v, v*i and v*i*i for the pixel index i within the span,
+        // shifted to the reference point below.
+        double s0 = 0.0;
+        double s1 = 0.0;
+        double s2 = 0.0;
+        T lo = p[0];
+        T hi = p[0];
+        for (int i = 0; i < n; ++i) {
+            double const v = static_cast<double>(p[i]);
+            s0 += v;
+            s1 += v*i;
+            s2 += v*i*i;
+            lo = std::min(lo, p[i]);
+            hi = std::max(hi, p[i]);
+        }
+        if (_count == 0) {
+            _min = lo;
+            _max = hi;
+        } else {
+            _min = std::min(_min, lo);
+            _max = std::max(_max, hi);
+        }
+        _count += n;
+        double const dx = x - _ref_x;
+        double const dy = y - _ref_y;
+        double const sx = dx*s0 + s1;
+        _s += s0;
+        _sx += sx;
+        _sy += dy*s0;
+        _sxx += dx*dx*s0 + 2.0*dx*s1 + s2;
+        _sxy += dy*sx;
+        _syy += dy*dy*s0;
+    }
+
+    PixelStats finish() const {
+        double const nan = std::numeric_limits<double>::quiet_NaN();
+        PixelStats stats = {_count, _s, nan, nan, nan, nan, nan, nan, nan};
+        if (_count > 0) {
+            stats.min = static_cast<double>(_min);
+            stats.max = static_cast<double>(_max);
+        }
+        if (_s != 0.0) {
+            double const x = _sx/_s;
+            double const y = _sy/_s;
+            stats.x = x + _ref_x;
+            stats.y = y + _ref_y;
+            stats.xx = _sxx/_s - x*x;
+            stats.xy = _sxy/_s - x*y;
+            stats.yy = _syy/_s - y*y;
+        }
+        return stats;
+    }
+
+private:
+    int _ref_x;
+    int _ref_y;
+    std::size_t _count;
+    T _min;
+    T _max;
+    double _s;
+    double _sx;
+    double _sy;
+    double _sxx;
+    double _sxy;
+    double _syy;
+};
+
+} // namespace detail
+
+template <typename T>
+SpanSet SpanSet::extract(ImageWrapper<T const> const & image, T value, int threads) {
+    return extract_if(image, Equal<T>{value}, threads);
+}
+
+template <typename T, typename Pred>
+SpanSet SpanSet::extract_if(ImageWrapper<T const> const & image, Pred const & pred, int threads) {
+    detail::OperationTimer timer(Operation::EXTRACT);
+    timer.pixels(std::uint64_t(image.bbox.width())*std::uint64_t(image.bbox.height()));
+    std::vector<Span> spans;
+    threads = detail::resolve_threads(threads);
+    if (threads == 1 || image.bbox.empty() || image.bbox.height() == 1) {
+        detail::scan_rows(image, pred, image.bbox.y(), spans);
+        timer.output(spans);
+        return SpanSet(std::move(spans));
+    }
+    // Each band of rows is scanned into its own buffer; the bands are in row
+    // order, so concatenating the buffers leaves the spans sorted.  There are
+    // more bands than threads because run density can vary a lot by row.
+    std::vector<std::size_t> bands = detail::even_chunks(image.bbox.height(), 4*threads);
+    std::vector<std::vector<Span>> found(bands.size() - 1);
+    detail::parallel_for(found.size(), threads, [&](std::size_t b) {
+        Interval const rows(image.bbox.y0() + static_cast<int>(bands[b]),
+                            image.bbox.y0() + static_cast<int>(bands[b + 1]) - 1);
+        detail::scan_rows(image, pred, rows, found[b]);
+    });
+    std::vector<std::size_t> offsets(found.size() + 1, 0u);
+    for (std::size_t b = 0; b < found.size(); ++b) {
+        offsets[b + 1] = offsets[b] + found[b].size();
+    }
+    spans.resize(offsets.back());
+    detail::parallel_for(found.size(), threads, [&](std::size_t b) {
+        std::copy(found[b].begin(), found[b].end(), spans.begin() + offsets[b]);
+        std::vector<Span>().swap(found[b]);
+    });
+    timer.output(spans);
+    return SpanSet(std::move(spans));
+}
+
+template <typename T>
+std::vector<SpanSet> SpanSet::extract_components(
+    ImageWrapper<T const> const & image, T value,
+    Connectivity connectivity,
+    ImageWrapper<std::int32_t> const * labels
+) {
+    return extract_components_if(image, Equal<T>{value}, connectivity, labels);
+}
+
+template <typename T, typename Pred>
+std::vector<SpanSet> SpanSet::extract_components_if(
+    ImageWrapper<T const> const & image, Pred const & pred,
+    Connectivity connectivity,
+    ImageWrapper<std::int32_t> const * labels
+) {
+    if (labels && labels->bbox != image.bbox) {
+        throw std::invalid_argument("Label image must have the same bbox as the image");
+    }
+    detail::OperationTimer timer(Operation::EXTRACT_COMPONENTS);
+    timer.pixels(std::uint64_t(image.bbox.width())*std::uint64_t(image.bbox.height()));
+    std::vector<Span> spans;
+    detail::UnionFind sets(0);
+    detail::SpanRuns const runs(spans);
+    // Rows are scanned a small band at a time, and the new runs joined to
+    // the runs above them while they're still in cache.  Runs found in one
+    // row never touch each other, so each row only needs to be joined to the
+    // one above.
+    int const band_height = 32;
+    std::size_t prev_first = 0;
+    std::size_t prev_last = 0;
+    int prev_y = 0;
+    for (int band_y0 = image.bbox.y0(); !image.bbox.empty();) {
+        int const band_y1 = (image.bbox.y1() - band_y0 >= band_height) ?
+            band_y0 + band_height - 1 : image.bbox.y1();
+        std::size_t first = spans.size();
+        detail::scan_rows(image, pred, Interval(band_y0, band_y1), spans);
+        sets.grow(spans.size());
+        while (first < spans.size()) {
+            int const y = spans[first].y();
+            std::size_t last = first + 1;
+            while (last < spans.size() && spans[last].y() == y) {
+                ++last;
+            }
+            if (prev_last != prev_first && prev_y + 1 == y) {
+                detail::unite_adjacent_rows(runs, prev_first, prev_last, first, last, connectivity, sets);
+            }
+            prev_first = first;
+            prev_last = last;
+            prev_y = y;
+            first = last;
+        }
+        if (band_y1 == image.bbox.y1()) {
+            break;
+        }
+        band_y0 = band_y1 + 1;
+    }
+    std::vector<std::size_t> component(spans.size());
+    for (std::size_t i = 0; i < spans.size(); ++i) {
+        component[i] = sets.find(i);
+    }
+    std::size_t const n = detail::number_components(component);
+    if (labels) {
+        if (n >= std::size_t(std::numeric_limits<std::int32_t>::max())) {
+            throw std::overflow_error("Too many components for an int32 label image");
+        }
+        std::int32_t * row = labels->ptr;
+        for (int y = 0; y < labels->bbox.height(); ++y, row += labels->stride) {
+            std::fill(row, row + labels->bbox.width(), 0);
+        }
+        for (std::size_t i = 0; i < spans.size(); ++i) {
+            std::int32_t * p = labels->ptr + labels->stride*(spans[i].y() - labels->bbox.y0())
+                + (spans[i].x0() - labels->bbox.x0());
+            std::fill(p, p + spans[i].x1() - spans[i].x0() + 1, static_cast<std::int32_t>(component[i] + 1));
+        }
+    }
+    timer.output(spans);
+    return group_components(spans, component, n).to_span_sets();
+}
+
+template <typename T>
+std::map<T, SpanSet> SpanSet::extract_labels_impl(
+    ImageWrapper<T const> const & image,
+    bool skip_background,
+    T background
+) {
+    // Spans are appended to each label's vector in scan order, so they're
+    // already sorted; consecutive runs usually share a label, so the last
+    // vector used is cached to avoid most of the hash lookups.
+    std::unordered_map<T, std::vector<Span>> groups;
+    std::vector<Span> * last_group = nullptr;
+    T last_label = T();
+    if (!image.bbox.empty()) {
+        T const * py = image.ptr;
+        int const width = image.bbox.width();
+        for (int y = image.bbox.y0(); y <= image.bbox.y1(); ++y) {
+            int x = 0;
+            while (x < width) {
+                T const label = py[x];
+                int const start = x;
+                do {
+                    ++x;
+                } while (x < width && py[x] == label);
+                if (skip_background && label == background) {
+                    continue;
+                }
+                if (!last_group || label != last_label) {
+                    last_group = &groups[label];
+                    last_label = label;
+                }
+                last_group->emplace_back(
+                    Interval(image.bbox.x0() + start, image.bbox.x0() + x - 1), y
+                );
+            }
+            py += image.stride;
+        }
+    }
+    std::map<T, SpanSet> result;
+    for (auto & group : groups) {
+        result.emplace(group.first, SpanSet(std::move(group.second)));
+    }
+    return result;
+}
+
+template <typename T>
+std::map<T, SpanSet> SpanSet::extract_labels(ImageWrapper<T const> const & image) {
+    return extract_labels_impl(image, false, T());
+}
+
+template <typename T>
+std::map<T, SpanSet> SpanSet::extract_labels(ImageWrapper<T const> const & image, T background) {
+    return extract_labels_impl(image, true, background);
+}
+
+template <typename T>
+void SpanSet::insert(ImageWrapper<T> const & image, T value, InsertMode mode, int threads) const {
+    mode = detail::resolve_insert_mode<T>(mode);
+    if (image.bbox.empty()) {
+        return;
+    }
+    detail::OperationTimer timer(Operation::INSERT);
+    timer.spans_in(size());
+    // Only spans in the image's rows are visited, and those need only be
+    // clipped in x.
+    auto const range = row_range(image.bbox.y());
+    std::size_t const first = range.first - begin();
+    std::size_t const last = range.second - begin();
+    detail::InsertFunction<T> const kernel = detail::insert_kernel<T>();
+    threads = detail::resolve_threads(threads);
+    std::vector<std::size_t> bands = detail::row_bands(_spans, first, last, threads);
+    // The timer isn't thread-safe, so each band counts its pixels separately.
+    std::vector<std::uint64_t> band_pixels(bands.size() - 1, 0u);
+    detail::parallel_for(bands.size() - 1, threads, [&](std::size_t b) {
+        for (std::size_t i = bands[b]; i < bands[b + 1]; ++i) {
+            Span const & span = _spans[i];
+            Interval const x_intersection = span.x() & image.bbox.x();
+            if (x_intersection.empty()) {
+                continue;
+            }
+            T * row = image.ptr + image.stride*(span.y() - image.bbox.y0());
+            detail::insert_span(row + x_intersection.min() - image.bbox.x0(),
+                                x_intersection.length(), value, mode, kernel);
+            band_pixels[b] += x_intersection.length();
+        }
+    });
+    for (auto n : band_pixels) {
+        timer.pixels(n);
+    }
+}
+
+template <typename T>
+PixelStats SpanSet::reduce(ImageWrapper<T const> const & image) const {
+    detail::OperationTimer timer(Operation::REDUCE);
+    timer.spans_in(size());
+    auto const range = row_range(image.bbox.y());
+    detail::Accumulator<T> accumulator(
+        range.first != range.second ? range.first->x0() : 0,
+        range.first != range.second ? range.first->y() : 0
+    );
+    for (auto span = range.first; span != range.second; ++span) {
+        Interval const x_intersection = span->x() & image.bbox.x();
+        if (x_intersection.empty()) {
+            continue;
+        }
+        T const * row = image.ptr + image.stride*(span->y() - image.bbox.y0());
+        timer.pixels(x_intersection.length());
+        accumulator.add(row + x_intersection.min() - image.bbox.x0(), x_intersection.length(),
+                        x_intersection.min(), span->y());
+    }
+    return accumulator.finish();
+}
+
+template <typename T>
+std::vector<PixelStats> SpanSet::reduce_all(
+    std::vector<SpanSet const *> const & sets, ImageWrapper<T const> const & image,
+    int threads
+) {
+    for (auto set : sets) {
+        if (!set) {
+            throw std::invalid_argument("reduce_all inputs may not be null");
+        }
+    }
+    std::vector<PixelStats> result(sets.size());
+    detail::parallel_for(sets.size(), threads, [&](std::size_t i) {
+        result[i] = sets[i]->reduce(image);
+    });
+    return result;
+}
+
+template <typename T>
+void StreamingExtractor::feed(ImageWrapper<T const> const & piece, T value) {
+    feed_if(piece, Equal<T>{value});
+}
+
+template <typename T, typename Pred>
+void StreamingExtractor::feed_if(ImageWrapper<T const> const & piece, Pred const & pred) {
+    if (piece.bbox.empty()) {
+        return;
+    }
+    Interval const rows = piece.bbox.y();
+    if (_band.empty() || rows.min() > _band.max()) {
+        complete_band();
+        _band = rows;
+        _rows.resize(rows.length());
+    } else if (rows != _band || piece.bbox.x0() < _next_x0) {
+        throw std::invalid_argument(
+            "Pieces must cover the rows of the current band, left to right, or start below it"
+        );
+    }
+    _next_x0 = piece.bbox.x1() + 1;
+    _scratch.clear();
+    detail::scan_rows(piece, pred, rows, _scratch);
+    // Only the first run of each row can continue one from the piece to
+    // the left.
+    for (auto const & span : _scratch) {
+        std::vector<Span> & row = _rows[span.y() - _band.min()];
+        if (!row.empty() && row.back().x1() + 1 == span.x0()) {
+            row.back() = Span(Interval(row.back().x0(), span.x1()), span.y());
+        } else {
+            row.push_back(span);
+        }
+    }
+}
+
+} // namespace spanops
+
+#endif // !SPANOPS_KERNELS_H_INCLUDED
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "spanops.h"
+
+namespace spanops {
+
+namespace {
+
+// Merge spans that overlap or touch in a sorted sequence, in place.
+void join_touching(std::vector<Span> & spans) {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < spans.size(); ++i) {
+        if (n > 0 && spans[n - 1].y() == spans[i].y() && spans[i].x0() <= spans[n - 1].x1() + 1) {
+            if (spans[i].x1() > spans[n - 1].x1()) {
+                spans[n - 1] = Span(Interval(spans[n - 1].x0(), spans[i].x1()), spans[i].y());
+            }
+        } else {
+            spans[n++] = spans[i];
+        }
+    }
+    spans.resize(n);
+}
+
+bool any_less(Span const & a, Span const & b) {
+    return a.y() < b.y() || (a.y() == b.y() && a.x0() < b.x0());
+}
+
+// One input span sequence shifted by a kernel span's row and widened by its
+// extent; the sequence stays sorted, so all of them can be merged with a
+// heap.
+struct Stream {
+    Span head;
+    SpanSet::iterator next;
+    SpanSet::iterator end;
+    Span offset;
+
+    Span apply(Span const & span) const {
+        return Span(Interval(span.x0() + offset.x0(), span.x1() + offset.x1()),
+                    span.y() + offset.y());
+    }
+};
+
+} // anonymous
+
+SpanSet SpanSet::dilated(SpanSet const & kernel) const {
+    if (empty() || kernel.empty()) {
+        return SpanSet();
+    }
+    std::vector<Stream> heap;
+    heap.reserve(kernel.size());
+    for (auto const & offset : kernel) {
+        Stream stream = {Span(), begin() + 1, end(), offset};
+        stream.head = stream.apply(*begin());
+        heap.push_back(stream);
+    }
+    auto later = [](Stream const & a, Stream const & b) { return any_less(b.head, a.head); };
+    std::make_heap(heap.begin(), heap.end(), later);
+    std::vector<Span> spans;
+    spans.reserve(size() + kernel.bbox().height());
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Stream & stream = heap.back();
+        Span const & span = stream.head;
+        if (!spans.empty() && spans.back().y() == span.y() && span.x0() <= spans.back().x1() + 1) {
+            if (span.x1() > spans.back().x1()) {
+                spans.back() = Span(Interval(spans.back().x0(), span.x1()), span.y());
+            }
+        } else {
+            spans.push_back(span);
+        }
+        if (stream.next == stream.end) {
+            heap.pop_back();
+        } else {
+            stream.head = stream.apply(*stream.next++);
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    return SpanSet(std::move(spans));
+}
+
+SpanSet SpanSet::eroded(SpanSet const & kernel) const {
+    if (kernel.empty()) {
+        throw std::invalid_argument("Cannot erode by an empty kernel");
+    }
+    // Erosion is the intersection, over the kernel's spans, of this SpanSet
+    // shifted up by the span's row and with each run shrunk by the span's
+    // extent.  Runs have to be maximal for the shrinking to be right.
+    std::vector<Span> runs(begin(), end());
+    join_touching(runs);
+    SpanSet result;
+    std::vector<Span> shrunk;
+    bool first = true;
+    for (auto const & k : kernel) {
+        shrunk.clear();
+        for (auto const & run : runs) {
+            Interval const x(run.x0() - k.x0(), run.x1() - k.x1());
+            if (!x.empty()) {
+                shrunk.emplace_back(x, run.y() - k.y());
+            }
+        }
+        if (first) {
+            result._spans = shrunk;
+            first = false;
+        } else {
+            result &= SpanSet(shrunk);
+        }
+        if (result.empty()) {
+            break;
+        }
+    }
+    return result;
+}
+
+SpanSet SpanSet::circle(int radius) {
+    std::vector<Span> spans;
+    for (int y = -radius; y <= radius; ++y) {
+        int const half = static_cast<int>(std::floor(std::sqrt(double(radius)*radius - double(y)*y)));
+        spans.emplace_back(Interval(-half, half), y);
+    }
+    return SpanSet(std::move(spans));
+}
+
+} // namespace spanops
@@ -0,0 +1,83 @@
+#ifndef SPANOPS_PARALLEL_H_INCLUDED
+#define SPANOPS_PARALLEL_H_INCLUDED
+
+// Minimal fork-join helpers for the multi-threaded operations.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace spanops {
+namespace detail {
+
+// Interpret a user-provided thread count: anything less than one means "as
+// many as the hardware supports".
+inline int resolve_threads(int threads) {
+    if (threads < 1) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    return std::max(threads, 1);
+}
+
+// Call task(i) for every i in [0, n) using up to 'threads' threads,
+// including the calling one.  Tasks are handed out in order but may run
+// concurrently, so they must not write to shared state.  The first exception
+// thrown by a task is rethrown once all threads have finished.
+template <typename Task>
+void parallel_for(std::size_t n, int threads, Task const & task) {
+    std::size_t const n_threads = std::min<std::size_t>(resolve_threads(threads), n);
+    if (n_threads <= 1) {
+        for (std::size_t i = 0; i < n; ++i) {
+            task(i);
+        }
+        return;
+    }
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&]() {
+        try {
+            for (std::size_t i = next++; i < n; i = next++) {
+                task(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next = n;
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads - 1);
+    for (std::size_t t = 1; t < n_threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Split [0, n) into up to 'parts' contiguous chunks of nearly equal size,
+// returned as chunk boundaries (so chunk i is [result[i], result[i + 1])).
+inline std::vector<std::size_t> even_chunks(std::size_t n, std::size_t parts) {
+    parts = std::max<std::size_t>(std::min(parts, n), 1);
+    std::vector<std::size_t> bounds(parts + 1);
+    for (std::size_t i = 0; i <= parts; ++i) {
+        bounds[i] = n*i/parts;
+    }
+    return bounds;
+}
+
+} // namespace detail
+} // namespace spanops
+
+#endif // !SPANOPS_PARALLEL_H_INCLUDED
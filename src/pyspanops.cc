@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <string>
+
 #include "pybind11/pybind11.h"
 #include "pybind11/operators.h"
 #include "pybind11/stl.h"
 #include "pybind11/numpy.h"
 #include "spanops.h"
+#include "stats.h"
 
 namespace py = pybind11;
 
@@ -20,44 +26,550 @@ void wrap_common(py::class_<Class, Args...> & cls) {
     cls.def_property_readonly("empty", &Class::empty);
 }
 
+// Bounding box of a 2-d array whose first pixel is at (x0, y0).
+Box image_bbox(py::array const & array, int x0, int y0) {
+    if (array.ndim() != 2) {
+        PyErr_SetString(PyExc_TypeError, "Array must have exactly 2 dimensions");
+        throw py::error_already_set();
+    }
+    return Box(Interval(x0, x0 + array.shape(1) - 1),
+               Interval(y0, y0 + array.shape(0) - 1));
+}
+
+template <typename T>
+ImageWrapper<T const> wrap_image(py::array_t<T, py::array::c_style> const & array, int x0, int y0) {
+    Box bbox = image_bbox(array, x0, y0);
+    return ImageWrapper<T const>{
+        array.data(),
+        static_cast<std::ptrdiff_t>(array.strides(0)/sizeof(T)),
+        bbox
+    };
+}
+
+template <typename T>
+ImageWrapper<T> wrap_mutable_image(py::array_t<T, py::array::c_style> & array, int x0, int y0) {
+    Box bbox = image_bbox(array, x0, y0);
+    return ImageWrapper<T>{
+        array.mutable_data(),
+        static_cast<std::ptrdiff_t>(array.strides(0)/sizeof(T)),
+        bbox
+    };
+}
+
+// Cast every item of 'sets' to a SpanSet, holding references to the items in
+// 'items' so they outlive the returned pointers even if 'sets' is a
+// generator.
+std::vector<SpanSet const *> span_set_pointers(py::iterable sets, std::vector<py::object> & items) {
+    std::vector<SpanSet const *> pointers;
+    for (auto item : sets) {
+        items.push_back(py::reinterpret_borrow<py::object>(item));
+        pointers.push_back(&items.back().cast<SpanSet const &>());
+    }
+    return pointers;
+}
+
+// The first byte of a contiguous buffer such as bytes, bytearray, or mmap.
+std::uint8_t const * buffer_data(py::buffer_info const & info) {
+    if (info.ndim > 1 || (info.ndim == 1 && info.strides[0] != info.itemsize)) {
+        PyErr_SetString(PyExc_TypeError, "Buffer must be contiguous");
+        throw py::error_already_set();
+    }
+    return static_cast<std::uint8_t const *>(info.ptr);
+}
+
+std::size_t buffer_size(py::buffer_info const & info) {
+    return static_cast<std::size_t>(info.size*info.itemsize);
+}
+
+py::bytes to_py_bytes(SpanSet const & spans) {
+    std::vector<std::uint8_t> bytes;
+    {
+        py::gil_scoped_release release;
+        bytes = spans.to_bytes();
+    }
+    detail::OperationTimer timer(Operation::PYTHON_CONVERSION);
+    timer.bytes(bytes.size());
+    return py::bytes(reinterpret_cast<char const *>(bytes.data()), bytes.size());
+}
+
+SpanSet from_py_buffer(py::buffer buffer) {
+    py::buffer_info info = buffer.request();
+    std::uint8_t const * data = buffer_data(info);
+    py::gil_scoped_release release;
+    return SpanSet::from_bytes(data, buffer_size(info));
+}
+
+// A SpanSetArchive that holds the buffer it reads from, usually an mmap, so
+// the memory stays mapped as long as the archive exists.
+class PyArchive {
+public:
+
+    explicit PyArchive(py::buffer buffer) :
+        _buffer(buffer), _info(buffer.request()),
+        _archive(buffer_data(_info), buffer_size(_info))
+    {}
+
+    SpanSetArchive const & archive() const { return _archive; }
+
+private:
+    py::buffer _buffer;
+    py::buffer_info _info;
+    SpanSetArchive _archive;
+};
+
+// A SpanSetExpression that holds references to the Python objects it was
+// built from (SpanSets or other PyExpressions), so the SpanSets it points to
+// outlive it.  The result is cached, since evaluate may be called more than
+// once.
+class PyExpression {
+public:
+
+    explicit PyExpression(py::object operand) :
+        _expression(leaf(operand)), _left(operand), _right()
+    {}
+
+    PyExpression(SpanSetExpression expression, py::object left, py::object right) :
+        _expression(std::move(expression)), _left(left), _right(right)
+    {}
+
+    // The expression for 'operand', or nullptr if it is neither a SpanSet
+    // nor a PyExpression.
+    static std::unique_ptr<SpanSetExpression> cast(py::object operand) {
+        if (py::isinstance<PyExpression>(operand)) {
+            return std::unique_ptr<SpanSetExpression>(
+                new SpanSetExpression(operand.cast<PyExpression const &>()._expression)
+            );
+        }
+        if (py::isinstance<SpanSet>(operand)) {
+            return std::unique_ptr<SpanSetExpression>(
+                new SpanSetExpression(operand.cast<SpanSet const &>())
+            );
+        }
+        return nullptr;
+    }
+
+    // Only called with the GIL held; the GIL is released while evaluating,
+    // so another thread may fill the cache first, in which case its result
+    // is kept.
+    SpanSet const & evaluate() {
+        if (!_result) {
+            SpanSet result;
+            {
+                py::gil_scoped_release release;
+                result = _expression.evaluate();
+            }
+            if (!_result) {
+                _result.reset(new SpanSet(std::move(result)));
+            }
+        }
+        return *_result;
+    }
+
+private:
+
+    static SpanSetExpression leaf(py::object operand) {
+        if (!py::isinstance<SpanSet>(operand)) {
+            throw py::type_error("SpanSetExpression operand must be a SpanSet");
+        }
+        return SpanSetExpression(operand.cast<SpanSet const &>());
+    }
+
+    SpanSetExpression _expression;
+    py::object _left;
+    py::object _right;
+    std::unique_ptr<SpanSet const> _result;
+};
+
+// Define the operator 'name' and its reflection on PyExpression, returning
+// NotImplemented for operands that aren't SpanSets or expressions.
+template <typename F>
+void wrap_expression_op(py::class_<PyExpression> & cls, char const * name, char const * rname, F f) {
+    auto combine = [f](py::object a, py::object b) -> py::object {
+        auto left = PyExpression::cast(a);
+        auto right = PyExpression::cast(b);
+        if (!left || !right) {
+            return py::reinterpret_borrow<py::object>(Py_NotImplemented);
+        }
+        return py::cast(PyExpression(f(*left, *right), a, b));
+    };
+    cls.def(name, combine, py::is_operator());
+    cls.def(rname, [combine](py::object a, py::object b) { return combine(b, a); }, py::is_operator());
+}
+
+template <typename Class, typename T>
+void wrap_insert(py::class_<Class> & cls) {
+    cls.def(
+        "insert",
+        [](Class const & self, py::array_t<T, py::array::c_style> array, T value, int x0, int y0,
+           InsertMode mode, int threads) {
+            ImageWrapper<T> image = wrap_mutable_image(array, x0, y0);
+            py::gil_scoped_release release;
+            self.insert(image, value, mode, threads);
+        },
+        "array"_a, "value"_a, "x0"_a=0, "y0"_a=0, "mode"_a=InsertMode::ADD, "threads"_a=1
+    );
+}
+
+// Convert SpanSets to a Python list, counting the time as Python conversion.
+py::list span_sets_to_py(std::vector<SpanSet> && sets) {
+    detail::OperationTimer timer(Operation::PYTHON_CONVERSION);
+    timer.spans_in(sets.size());
+    py::list result(sets.size());
+    for (std::size_t i = 0; i < sets.size(); ++i) {
+        result[i] = py::cast(std::move(sets[i]));
+    }
+    return result;
+}
+
+// Shared implementation of the extract_components methods: return the list
+// of components, or (components, labels) if 'labels' is true.
+template <typename T, typename Pred>
+py::object components_to_py(py::array_t<T, py::array::c_style> const & array, int x0, int y0,
+                            Pred const & pred, Connectivity connectivity, bool labels) {
+    ImageWrapper<T const> image = wrap_image(array, x0, y0);
+    std::vector<SpanSet> components;
+    if (!labels) {
+        {
+            py::gil_scoped_release release;
+            components = SpanSet::extract_components_if(image, pred, connectivity);
+        }
+        return span_sets_to_py(std::move(components));
+    }
+    py::array_t<std::int32_t, py::array::c_style> label_array({array.shape(0), array.shape(1)});
+    ImageWrapper<std::int32_t> label_image = wrap_mutable_image(label_array, x0, y0);
+    {
+        py::gil_scoped_release release;
+        components = SpanSet::extract_components_if(image, pred, connectivity, &label_image);
+    }
+    return py::make_tuple(span_sets_to_py(std::move(components)), label_array);
+}
+
 template <typename T>
 void wrap_image_ops(py::class_<SpanSet> & cls) {
+    cls.def(
+        "reduce",
+        [](SpanSet const & self, py::array_t<T, py::array::c_style> array, int x0, int y0) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return self.reduce(image);
+        },
+        "array"_a, "x0"_a=0, "y0"_a=0
+    );
+    cls.def_static(
+        "reduce_all",
+        [](py::iterable sets, py::array_t<T, py::array::c_style> array, int x0, int y0,
+           int threads) {
+            std::vector<py::object> items;
+            std::vector<SpanSet const *> pointers = span_set_pointers(sets, items);
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::reduce_all(pointers, image, threads);
+        },
+        "sets"_a, "array"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
     cls.def(
         "insert",
-        [](SpanSet & self, py::array_t<T, py::array::c_style> array, T value, int x0, int y0) {
-            if (array.ndim() != 2) {
-                PyErr_SetString(PyExc_TypeError, "Array must have exactly 2 dimensions");
-                throw py::error_already_set();
-            }
-            ImageWrapper<T> w = {
-                array.mutable_data(),
-                static_cast<std::ptrdiff_t>(array.strides(0)/sizeof(T)),
-                Box(Interval(x0, x0 + array.shape(1) - 1),
-                    Interval(y0, y0 + array.shape(0) - 1))
-            };
-            self.insert(w, value);
+        [](SpanSet const & self, py::array_t<T, py::array::c_style> array, T value, int x0, int y0,
+           InsertMode mode, int threads) {
+            ImageWrapper<T> image = wrap_mutable_image(array, x0, y0);
+            py::gil_scoped_release release;
+            self.insert(image, value, mode, threads);
         },
-        "array"_a, "value"_a, "x0"_a=0, "y0"_a=0
+        "array"_a, "value"_a, "x0"_a=0, "y0"_a=0, "mode"_a=InsertMode::ADD, "threads"_a=1
     );
     cls.def_static(
         "extract",
-        [](py::array_t<T, py::array::c_style> array, T value, int x0, int y0) {
-            if (array.ndim() != 2) {
-                PyErr_SetString(PyExc_TypeError, "Array must have exactly 2 dimensions");
-                throw py::error_already_set();
-            }
-            ImageWrapper<T const> w = {
-                array.data(),
-                static_cast<std::ptrdiff_t>(array.strides(0)/sizeof(T)),
-                Box(Interval(x0, x0 + array.shape(1) - 1),
-                    Interval(y0, y0 + array.shape(0) - 1))
-            };
-            return SpanSet::extract(w, value);
+        [](py::array_t<T, py::array::c_style> array, T value, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract(image, value, threads);
+        },
+        "array"_a, "value"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_components",
+        [](py::array_t<T, py::array::c_style> array, T value, Connectivity connectivity,
+           int x0, int y0, bool labels) {
+            return components_to_py(array, x0, y0, Equal<T>{value}, connectivity, labels);
+        },
+        "array"_a, "value"_a, "connectivity"_a=Connectivity::FOUR, "x0"_a=0, "y0"_a=0,
+        "labels"_a=false,
+        "Equivalent to extract(array, value).split(connectivity), but in one pass\n"
+        "over the image.  With labels=True, return (components, labels), where\n"
+        "labels is an int32 array like 'array' holding one plus the index of the\n"
+        "component each pixel is in, or zero."
+    );
+}
+
+// Threshold predicates; for every pixel type except bool.
+template <typename T>
+void wrap_comparison_ops(py::class_<SpanSet> & cls) {
+    cls.def_static(
+        "extract_greater",
+        [](py::array_t<T, py::array::c_style> array, T threshold, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, Greater<T>{threshold}, threads);
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_greater_equal",
+        [](py::array_t<T, py::array::c_style> array, T threshold, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, GreaterEqual<T>{threshold}, threads);
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_less",
+        [](py::array_t<T, py::array::c_style> array, T threshold, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, Less<T>{threshold}, threads);
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_less_equal",
+        [](py::array_t<T, py::array::c_style> array, T threshold, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, LessEqual<T>{threshold}, threads);
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_in_range",
+        [](py::array_t<T, py::array::c_style> array, T min, T max, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, InRange<T>{min, max}, threads);
+        },
+        "array"_a, "min"_a, "max"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_components_greater",
+        [](py::array_t<T, py::array::c_style> array, T threshold, Connectivity connectivity,
+           int x0, int y0, bool labels) {
+            return components_to_py(array, x0, y0, Greater<T>{threshold}, connectivity, labels);
+        },
+        "array"_a, "threshold"_a, "connectivity"_a=Connectivity::FOUR, "x0"_a=0, "y0"_a=0,
+        "labels"_a=false
+    );
+    cls.def_static(
+        "extract_components_greater_equal",
+        [](py::array_t<T, py::array::c_style> array, T threshold, Connectivity connectivity,
+           int x0, int y0, bool labels) {
+            return components_to_py(array, x0, y0, GreaterEqual<T>{threshold}, connectivity, labels);
+        },
+        "array"_a, "threshold"_a, "connectivity"_a=Connectivity::FOUR, "x0"_a=0, "y0"_a=0,
+        "labels"_a=false
+    );
+    cls.def_static(
+        "extract_components_less",
+        [](py::array_t<T, py::array::c_style> array, T threshold, Connectivity connectivity,
+           int x0, int y0, bool labels) {
+            return components_to_py(array, x0, y0, Less<T>{threshold}, connectivity, labels);
+        },
+        "array"_a, "threshold"_a, "connectivity"_a=Connectivity::FOUR, "x0"_a=0, "y0"_a=0,
+        "labels"_a=false
+    );
+    cls.def_static(
+        "extract_components_less_equal",
+        [](py::array_t<T, py::array::c_style> array, T threshold, Connectivity connectivity,
+           int x0, int y0, bool labels) {
+            return components_to_py(array, x0, y0, LessEqual<T>{threshold}, connectivity, labels);
+        },
+        "array"_a, "threshold"_a, "connectivity"_a=Connectivity::FOUR, "x0"_a=0, "y0"_a=0,
+        "labels"_a=false
+    );
+    cls.def_static(
+        "extract_components_in_range",
+        [](py::array_t<T, py::array::c_style> array, T min, T max, Connectivity connectivity,
+           int x0, int y0, bool labels) {
+            return components_to_py(array, x0, y0, InRange<T>{min, max}, connectivity, labels);
+        },
+        "array"_a, "min"_a, "max"_a, "connectivity"_a=Connectivity::FOUR, "x0"_a=0, "y0"_a=0,
+        "labels"_a=false
+    );
+}
+
+// Label images; for the integer pixel types.
+template <typename T>
+void wrap_label_ops(py::class_<SpanSet> & cls) {
+    cls.def_static(
+        "extract_labels",
+        [](py::array_t<T, py::array::c_style> array, py::object background, int x0, int y0) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            if (background.is_none()) {
+                py::gil_scoped_release release;
+                return SpanSet::extract_labels(image);
+            }
+            T const value = background.cast<T>();
+            py::gil_scoped_release release;
+            return SpanSet::extract_labels(image, value);
+        },
+        "array"_a, "background"_a=py::none(), "x0"_a=0, "y0"_a=0
+    );
+}
+
+// Bitmask predicates; for the unsigned integer pixel types.
+template <typename T>
+void wrap_bit_ops(py::class_<SpanSet> & cls) {
+    cls.def_static(
+        "extract_any_bits",
+        [](py::array_t<T, py::array::c_style> array, T bits, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, AnyBits<T>{bits}, threads);
+        },
+        "array"_a, "bits"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+    cls.def_static(
+        "extract_all_bits",
+        [](py::array_t<T, py::array::c_style> array, T bits, int x0, int y0, int threads) {
+            ImageWrapper<T const> image = wrap_image(array, x0, y0);
+            py::gil_scoped_release release;
+            return SpanSet::extract_if(image, AllBits<T>{bits}, threads);
+        },
+        "array"_a, "bits"_a, "x0"_a=0, "y0"_a=0, "threads"_a=1
+    );
+}
+
+template <typename T, typename Pred>
+void feed_piece(StreamingExtractor & self, py::array_t<T, py::array::c_style> const & array,
+                int x0, int y0, Pred const & pred) {
+    ImageWrapper<T const> image = wrap_image(array, x0, y0);
+    py::gil_scoped_release release;
+    self.feed_if(image, pred);
+}
+
+// StreamingExtractor counterparts of wrap_image_ops' extract and of
+// wrap_comparison_ops and wrap_bit_ops, for the same pixel types.
+template <typename T>
+void wrap_feed_ops(py::class_<StreamingExtractor> & cls) {
+    cls.def(
+        "feed",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T value,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, Equal<T>{value});
         },
         "array"_a, "value"_a, "x0"_a=0, "y0"_a=0
     );
 }
 
+template <typename T>
+void wrap_feed_comparisons(py::class_<StreamingExtractor> & cls) {
+    cls.def(
+        "feed_greater",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T threshold,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, Greater<T>{threshold});
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0
+    );
+    cls.def(
+        "feed_greater_equal",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T threshold,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, GreaterEqual<T>{threshold});
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0
+    );
+    cls.def(
+        "feed_less",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T threshold,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, Less<T>{threshold});
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0
+    );
+    cls.def(
+        "feed_less_equal",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T threshold,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, LessEqual<T>{threshold});
+        },
+        "array"_a, "threshold"_a, "x0"_a=0, "y0"_a=0
+    );
+    cls.def(
+        "feed_in_range",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T min, T max,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, InRange<T>{min, max});
+        },
+        "array"_a, "min"_a, "max"_a, "x0"_a=0, "y0"_a=0
+    );
+}
+
+template <typename T>
+void wrap_feed_bits(py::class_<StreamingExtractor> & cls) {
+    cls.def(
+        "feed_any_bits",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T bits,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, AnyBits<T>{bits});
+        },
+        "array"_a, "bits"_a, "x0"_a=0, "y0"_a=0
+    );
+    cls.def(
+        "feed_all_bits",
+        [](StreamingExtractor & self, py::array_t<T, py::array::c_style> array, T bits,
+           int x0, int y0) {
+            feed_piece(self, array, x0, y0, AllBits<T>{bits});
+        },
+        "array"_a, "bits"_a, "x0"_a=0, "y0"_a=0
+    );
+}
+
+void declareStats(py::module & mod) {
+    mod.def(
+        "stats",
+        []() {
+            std::vector<OperationStats> const totals = get_stats();
+            py::dict result;
+            for (std::size_t i = 0; i < totals.size(); ++i) {
+                OperationStats const & t = totals[i];
+                result[operation_name(static_cast<Operation>(i))] = py::dict(
+                    "calls"_a=t.calls, "spans_in"_a=t.spans_in, "spans_out"_a=t.spans_out,
+                    "pixels"_a=t.pixels, "bytes"_a=t.bytes, "seconds"_a=t.nanoseconds*1e-9
+                );
+            }
+            return result;
+        },
+        "Return a dict of per-operation counters: calls, spans_in, spans_out,\n"
+        "pixels, bytes and seconds.  Counting is off until enable_stats() (or\n"
+        "start_trace()) is called."
+    );
+    mod.def("enable_stats", &enable_stats, "enabled"_a=true);
+    mod.def("stats_enabled", &stats_enabled);
+    mod.def("reset_stats", &reset_stats);
+    mod.def(
+        "start_trace", &start_trace,
+        "Enable counting and start recording every operation as a Chrome trace\n"
+        "event, discarding any previous trace."
+    );
+    mod.def(
+        "stop_trace",
+        [](py::object path) {
+            stop_trace();
+            if (!path.is_none()) {
+                std::string const filename = py::str(path);
+                std::ofstream stream(filename);
+                if (!stream) {
+                    throw std::runtime_error("Could not open '" + filename + "' for writing");
+                }
+                write_trace(stream);
+            }
+        },
+        "path"_a=py::none(),
+        "Stop recording, and write the trace as JSON to 'path' if given (for\n"
+        "chrome://tracing or Perfetto).  Counting stays enabled."
+    );
+}
+
 void declareInterval(py::module & mod) {
     py::class_<Interval> cls(mod, "Interval");
     cls.def(py::init<>());
@@ -166,13 +678,61 @@ void declareBox(py::module & mod) {
     wrap_common(cls);
 }
 
+void declareConnectivity(py::module & mod) {
+    py::enum_<Connectivity>(mod, "Connectivity")
+        .value("FOUR", Connectivity::FOUR)
+        .value("EIGHT", Connectivity::EIGHT);
+}
+
+void declarePixelStats(py::module & mod) {
+    py::class_<PixelStats>(mod, "PixelStats")
+        .def_readonly("count", &PixelStats::count)
+        .def_readonly("sum", &PixelStats::sum)
+        .def_readonly("min", &PixelStats::min)
+        .def_readonly("max", &PixelStats::max)
+        .def_readonly("x", &PixelStats::x)
+        .def_readonly("y", &PixelStats::y)
+        .def_readonly("xx", &PixelStats::xx)
+        .def_readonly("xy", &PixelStats::xy)
+        .def_readonly("yy", &PixelStats::yy)
+        .def_property_readonly("mean", &PixelStats::mean);
+}
+
+void declareInsertMode(py::module & mod) {
+    py::enum_<InsertMode>(mod, "InsertMode")
+        .value("ADD", InsertMode::ADD)
+        .value("ASSIGN", InsertMode::ASSIGN)
+        .value("OR", InsertMode::OR)
+        .value("MAX", InsertMode::MAX);
+}
+
+// SpanSet.as_array and from_array view Spans as rows of three int32 values.
+static_assert(std::is_standard_layout<Span>::value && sizeof(Span) == 3*sizeof(std::int32_t),
+              "Span must be laid out as (y, x0, x1)");
+
 void declareSpanSet(py::module & mod) {
-    py::class_<SpanSet> cls(mod, "SpanSet");
+    py::class_<SpanSet> cls(
+        mod, "SpanSet",
+        "A set of pixels, stored as sorted, non-overlapping Spans.\n\n"
+        "SpanSets are immutable in Python (|= and &= rebind the name to a new\n"
+        "SpanSet), so as_array can return a view and any number of threads can\n"
+        "share one.  All methods that scan images or SpanSets release the GIL\n"
+        "while they run; insert needs exclusive access to the array it writes\n"
+        "to, which is kept alive by the call for its whole duration."
+    );
+    auto const release_gil = py::call_guard<py::gil_scoped_release>();
     cls
         .def(py::init<>())
         .def(py::init<Box>())
-        .def_property_readonly("area", &SpanSet::area)
-        .def_property_readonly("bbox", &SpanSet::bbox, py::return_value_policy::copy)
+        .def_property_readonly("area", [](SpanSet const & self) {
+            py::gil_scoped_release release;
+            return self.area();
+        })
+        .def_property_readonly("bbox", [](SpanSet const & self) {
+            py::gil_scoped_release release;
+            return self.bbox();
+        })
+        .def_property_readonly("empty", &SpanSet::empty)
         .def("__len__", &SpanSet::size)
         .def(
              "__iter__",
@@ -180,11 +740,130 @@ void declareSpanSet(py::module & mod) {
                 return py::make_iterator(self.begin(), self.end());
              }
         )
-        .def(py::self | py::self)
-        .def(py::self |= py::self)
-        .def("split", &SpanSet::split)
+        .def("__or__", [](SpanSet const & a, SpanSet const & b) { return a | b; },
+             py::is_operator(), release_gil)
+        .def("__and__", [](SpanSet const & a, SpanSet const & b) { return a & b; },
+             py::is_operator(), release_gil)
+        .def("__sub__", [](SpanSet const & a, SpanSet const & b) { return a - b; },
+             py::is_operator(), release_gil)
+        .def("__xor__", [](SpanSet const & a, SpanSet const & b) { return a ^ b; },
+             py::is_operator(), release_gil)
+        .def("__ior__", [](SpanSet const & a, SpanSet const & b) { return a | b; },
+             py::is_operator(), release_gil)
+        .def("__iand__", [](SpanSet const & a, SpanSet const & b) { return a & b; },
+             py::is_operator(), release_gil)
+        .def("__isub__", [](SpanSet const & a, SpanSet const & b) { return a - b; },
+             py::is_operator(), release_gil)
+        .def("__ixor__", [](SpanSet const & a, SpanSet const & b) { return a ^ b; },
+             py::is_operator(), release_gil)
+        .def("__eq__", [](SpanSet const & a, SpanSet const & b) { return a == b; },
+             py::is_operator(), release_gil)
+        .def("__ne__", [](SpanSet const & a, SpanSet const & b) { return a != b; },
+             py::is_operator(), release_gil)
+        .def(
+            "split",
+            [](SpanSet const & self, Connectivity connectivity, int threads) {
+                std::vector<SpanSet> components;
+                {
+                    py::gil_scoped_release release;
+                    components = self.split(connectivity, threads);
+                }
+                return span_sets_to_py(std::move(components));
+            },
+            "connectivity"_a=Connectivity::FOUR, "threads"_a=1
+        )
+        .def("split_collection", &SpanSet::split_collection,
+             "connectivity"_a=Connectivity::FOUR, "threads"_a=1, release_gil)
+        .def("contains", [](SpanSet const & self, SpanSet const & other) { return self.contains(other); },
+             "other"_a, release_gil)
+        // The array overload comes before the scalar one so that size-1 arrays
+        // of other dtypes, which pybind11 can also convert to int, still give
+        // an array back.
+        .def(
+            "contains",
+            [](SpanSet const & self,
+               py::array_t<int, py::array::c_style | py::array::forcecast> xs,
+               py::array_t<int, py::array::c_style | py::array::forcecast> ys) {
+                if (xs.ndim() != ys.ndim() ||
+                    !std::equal(xs.shape(), xs.shape() + xs.ndim(), ys.shape())) {
+                    throw std::invalid_argument("x and y arrays must have the same shape");
+                }
+                py::array_t<bool> result(std::vector<py::ssize_t>(xs.shape(), xs.shape() + xs.ndim()));
+                bool * out = result.mutable_data();
+                {
+                    py::gil_scoped_release release;
+                    self.contains(xs.data(), ys.data(), static_cast<std::size_t>(xs.size()), out);
+                }
+                return result;
+            },
+            "x"_a, "y"_a,
+            "Return a bool array that is True where (x, y) is in this SpanSet.\n"
+            "Coordinates are converted to 32-bit ints; points sorted by y and then\n"
+            "x are matched fastest."
+        )
+        .def("contains", [](SpanSet const & self, int x, int y) { return self.contains(x, y); },
+             "x"_a, "y"_a)
+        .def("overlaps", [](SpanSet const & self, Box const & box) { return self.overlaps(box); },
+             "box"_a, release_gil)
+        .def("overlaps", [](SpanSet const & self, SpanSet const & other) { return self.overlaps(other); },
+             "other"_a, release_gil)
+        .def("dilated", &SpanSet::dilated, "kernel"_a, release_gil)
+        .def("eroded", &SpanSet::eroded, "kernel"_a, release_gil)
+        .def_static("circle", &SpanSet::circle, "radius"_a, release_gil)
+        .def(
+            "as_array",
+            [](py::object self) {
+                // A read-only (N, 3) view of the (y, x0, x1) values that keeps
+                // the SpanSet alive.
+                SpanSet const & spans = self.cast<SpanSet const &>();
+                py::array_t<std::int32_t> array(
+                    {static_cast<py::ssize_t>(spans.size()), static_cast<py::ssize_t>(3)},
+                    {static_cast<py::ssize_t>(sizeof(Span)), static_cast<py::ssize_t>(sizeof(std::int32_t))},
+                    spans.empty() ? nullptr : reinterpret_cast<std::int32_t const *>(&*spans.begin()),
+                    self
+                );
+                array.attr("setflags")("write"_a=false);
+                return array;
+            }
+        )
+        .def_static(
+            "from_array",
+            [](py::array_t<std::int32_t, py::array::c_style | py::array::forcecast> array) {
+                if (array.ndim() != 2 || array.shape(1) != 3) {
+                    PyErr_SetString(PyExc_TypeError, "Array must have shape (N, 3)");
+                    throw py::error_already_set();
+                }
+                std::int32_t const * data = array.data();
+                std::size_t const n = array.shape(0);
+                py::gil_scoped_release release;
+                detail::OperationTimer timer(Operation::PYTHON_CONVERSION);
+                timer.spans_in(n);
+                std::vector<Span> spans;
+                spans.reserve(n);
+                for (std::size_t i = 0; i < n; ++i, data += 3) {
+                    spans.emplace_back(Interval(data[1], data[2]), data[0]);
+                }
+                return SpanSet::from_spans(std::move(spans));
+            },
+            "array"_a
+        )
+        .def_static(
+            "union_all",
+            [](py::iterable sets, int threads) {
+                std::vector<py::object> items;
+                std::vector<SpanSet const *> pointers = span_set_pointers(sets, items);
+                py::gil_scoped_release release;
+                return SpanSet::union_all(pointers, threads);
+            },
+            "sets"_a, "threads"_a=1
+        )
+        .def("to_bytes", &to_py_bytes)
+        .def_static("from_bytes", &from_py_buffer, "data"_a)
+        .def(py::pickle(&to_py_bytes, &from_py_buffer))
+        .def("lazy", [](py::object self) { return PyExpression(self); },
+             "Return an expression that combines this SpanSet with others only when\n"
+             "evaluated; see SpanSetExpression.")
     ;
-    wrap_common(cls);
     wrap_image_ops<bool>(cls);
     wrap_image_ops<std::uint8_t>(cls);
     wrap_image_ops<std::int8_t>(cls);
@@ -196,18 +875,327 @@ void declareSpanSet(py::module & mod) {
     wrap_image_ops<std::int64_t>(cls);
     wrap_image_ops<float>(cls);
     wrap_image_ops<double>(cls);
+    wrap_comparison_ops<std::uint8_t>(cls);
+    wrap_comparison_ops<std::int8_t>(cls);
+    wrap_comparison_ops<std::uint16_t>(cls);
+    wrap_comparison_ops<std::int16_t>(cls);
+    wrap_comparison_ops<std::uint32_t>(cls);
+    wrap_comparison_ops<std::int32_t>(cls);
+    wrap_comparison_ops<std::uint64_t>(cls);
+    wrap_comparison_ops<std::int64_t>(cls);
+    wrap_comparison_ops<float>(cls);
+    wrap_comparison_ops<double>(cls);
+    wrap_label_ops<std::uint8_t>(cls);
+    wrap_label_ops<std::int8_t>(cls);
+    wrap_label_ops<std::uint16_t>(cls);
+    wrap_label_ops<std::int16_t>(cls);
+    wrap_label_ops<std::uint32_t>(cls);
+    wrap_label_ops<std::int32_t>(cls);
+    wrap_label_ops<std::uint64_t>(cls);
+    wrap_label_ops<std::int64_t>(cls);
+    wrap_bit_ops<std::uint8_t>(cls);
+    wrap_bit_ops<std::uint16_t>(cls);
+    wrap_bit_ops<std::uint32_t>(cls);
+    wrap_bit_ops<std::uint64_t>(cls);
 }
 
 
+void declareCompactSpanSet(py::module & mod) {
+    py::class_<CompactSpanSet> cls(
+        mod, "CompactSpanSet",
+        "Row-indexed SpanSet storage: 8 bytes per span plus 4 per row, with\n"
+        "constant-time access to each row's spans."
+    );
+    auto const release_gil = py::call_guard<py::gil_scoped_release>();
+    cls
+        .def(py::init<>())
+        .def(py::init<SpanSet const &>(), "spans"_a, release_gil)
+        .def("to_span_set", &CompactSpanSet::to_span_set, release_gil)
+        .def_property_readonly("area", &CompactSpanSet::area, release_gil)
+        .def_property_readonly("bbox", &CompactSpanSet::bbox, release_gil)
+        .def_property_readonly("rows", &CompactSpanSet::rows)
+        .def_property_readonly("empty", &CompactSpanSet::empty)
+        .def("__len__", &CompactSpanSet::size)
+        .def("row_size", &CompactSpanSet::row_size, "y"_a)
+        .def("__and__", [](CompactSpanSet const & a, CompactSpanSet const & b) { return a & b; },
+             py::is_operator(), release_gil)
+        .def("__eq__", [](CompactSpanSet const & a, CompactSpanSet const & b) { return a == b; },
+             py::is_operator(), release_gil)
+        .def("__ne__", [](CompactSpanSet const & a, CompactSpanSet const & b) { return a != b; },
+             py::is_operator(), release_gil)
+        .def("split", &CompactSpanSet::split, "connectivity"_a=Connectivity::FOUR, release_gil)
+    ;
+    wrap_insert<CompactSpanSet, bool>(cls);
+    wrap_insert<CompactSpanSet, std::uint8_t>(cls);
+    wrap_insert<CompactSpanSet, std::int8_t>(cls);
+    wrap_insert<CompactSpanSet, std::uint16_t>(cls);
+    wrap_insert<CompactSpanSet, std::int16_t>(cls);
+    wrap_insert<CompactSpanSet, std::uint32_t>(cls);
+    wrap_insert<CompactSpanSet, std::int32_t>(cls);
+    wrap_insert<CompactSpanSet, std::uint64_t>(cls);
+    wrap_insert<CompactSpanSet, std::int64_t>(cls);
+    wrap_insert<CompactSpanSet, float>(cls);
+    wrap_insert<CompactSpanSet, double>(cls);
+}
+
+void declareSpanSetCollection(py::module & mod) {
+    py::class_<SpanSetCollection> cls(
+        mod, "SpanSetCollection",
+        "Many SpanSets stored back to back in one buffer, as returned by\n"
+        "SpanSet.split_collection.  Indexing or iterating returns copies as\n"
+        "SpanSets; as_arrays returns read-only views of all of them at once."
+    );
+    cls
+        .def(py::init<>())
+        .def("__len__", &SpanSetCollection::size)
+        .def(
+            "__getitem__",
+            [](SpanSetCollection const & self, std::ptrdiff_t i) {
+                if (i < 0) {
+                    i += static_cast<std::ptrdiff_t>(self.size());
+                }
+                if (i < 0 || std::size_t(i) >= self.size()) {
+                    throw py::index_error();
+                }
+                return self[i].to_span_set();
+            }
+        )
+        .def_property_readonly("areas", [](SpanSetCollection const & self) {
+            py::array_t<std::int64_t> result(static_cast<py::ssize_t>(self.size()));
+            std::int64_t * out = result.mutable_data();
+            {
+                py::gil_scoped_release release;
+                for (std::size_t i = 0; i < self.size(); ++i) {
+                    out[i] = self[i].area();
+                }
+            }
+            return result;
+        })
+        .def(
+            "as_arrays",
+            [](py::object self) {
+                // Read-only views that keep the collection alive: the (N, 3)
+                // (y, x0, x1) values of all spans, and the offsets of each
+                // SpanSet's first span, followed by N.
+                SpanSetCollection const & collection = self.cast<SpanSetCollection const &>();
+                std::vector<Span> const & spans = collection.spans();
+                py::array_t<std::int32_t> span_array(
+                    {static_cast<py::ssize_t>(spans.size()), static_cast<py::ssize_t>(3)},
+                    {static_cast<py::ssize_t>(sizeof(Span)), static_cast<py::ssize_t>(sizeof(std::int32_t))},
+                    spans.empty() ? nullptr : reinterpret_cast<std::int32_t const *>(spans.data()),
+                    self
+                );
+                span_array.attr("setflags")("write"_a=false);
+                py::array_t<std::size_t> offset_array(
+                    static_cast<py::ssize_t>(collection.offsets().size()),
+                    collection.offsets().data(),
+                    self
+                );
+                offset_array.attr("setflags")("write"_a=false);
+                return py::make_tuple(span_array, offset_array);
+            }
+        )
+        .def(
+            "to_list",
+            [](SpanSetCollection const & self, int threads) {
+                std::vector<SpanSet> sets;
+                {
+                    py::gil_scoped_release release;
+                    sets = self.to_span_sets(threads);
+                }
+                return span_sets_to_py(std::move(sets));
+            },
+            "threads"_a=1
+        )
+    ;
+}
+
+void declareSpanSetIndex(py::module & mod) {
+    py::class_<SpanSetIndex> cls(
+        mod, "SpanSetIndex",
+        "An R-tree over a list of SpanSets, for finding the ones that overlap a\n"
+        "Box, a point, or each other.  Results are exact, not just bbox overlaps."
+    );
+    auto const release_gil = py::call_guard<py::gil_scoped_release>();
+    cls
+        .def(py::init<std::vector<SpanSet>, int>(), "sets"_a, "node_size"_a=16, release_gil)
+        .def("__len__", &SpanSetIndex::size)
+        .def(
+            "__getitem__",
+            [](SpanSetIndex const & self, std::ptrdiff_t i) {
+                if (i < 0) {
+                    i += static_cast<std::ptrdiff_t>(self.size());
+                }
+                if (i < 0 || std::size_t(i) >= self.size()) {
+                    throw py::index_error();
+                }
+                return self[i];
+            }
+        )
+        .def("query", [](SpanSetIndex const & self, Box const & box) { return self.query(box); },
+             "box"_a, release_gil)
+        .def("query", [](SpanSetIndex const & self, int x, int y) { return self.query(x, y); },
+             "x"_a, "y"_a, release_gil)
+        .def(
+            "overlapping_pairs",
+            [](SpanSetIndex const & self, int threads) {
+                std::vector<std::pair<std::size_t, std::size_t>> pairs;
+                {
+                    py::gil_scoped_release release;
+                    pairs = self.overlapping_pairs(threads);
+                }
+                py::array_t<std::int64_t> result({pairs.size(), std::size_t(2)});
+                auto r = result.mutable_unchecked<2>();
+                for (std::size_t n = 0; n < pairs.size(); ++n) {
+                    r(n, 0) = pairs[n].first;
+                    r(n, 1) = pairs[n].second;
+                }
+                return result;
+            },
+            "threads"_a=1,
+            "Return an (N, 2) array of the index pairs (i, j), i < j, that overlap."
+        )
+    ;
+}
+
+void declareSpanSetArchive(py::module & mod) {
+    py::class_<PyArchive> cls(
+        mod, "SpanSetArchive",
+        "Random access to the SpanSets in an archive file, decoding each one on\n"
+        "request.  Construct from any contiguous buffer; an mmap of the file\n"
+        "avoids reading it into memory."
+    );
+    cls
+        .def(py::init<py::buffer>(), "buffer"_a)
+        .def("__len__", [](PyArchive const & self) { return self.archive().size(); })
+        .def(
+            "__getitem__",
+            [](PyArchive const & self, std::ptrdiff_t i) {
+                std::size_t const n = self.archive().size();
+                if (i < 0) {
+                    i += static_cast<std::ptrdiff_t>(n);
+                }
+                if (i < 0 || std::size_t(i) >= n) {
+                    throw py::index_error();
+                }
+                py::gil_scoped_release release;
+                return self.archive()[i];
+            }
+        )
+        .def_static(
+            "write",
+            [](std::string const & path, py::iterable sets) {
+                std::vector<py::object> items;
+                std::vector<SpanSet const *> pointers = span_set_pointers(sets, items);
+                py::gil_scoped_release release;
+                std::ofstream stream(path, std::ios::binary);
+                if (!stream) {
+                    throw std::runtime_error("Could not open '" + path + "' for writing");
+                }
+                SpanSetArchiveWriter writer(stream);
+                for (auto set : pointers) {
+                    writer.write(*set);
+                }
+                writer.close();
+            },
+            "path"_a, "sets"_a,
+            "Write an archive of the given SpanSets to a file."
+        )
+    ;
+}
+
+void declareSpanSetExpression(py::module & mod) {
+    py::class_<PyExpression> cls(
+        mod, "SpanSetExpression",
+        "A deferred combination of SpanSets with |, &, - and ^:\n"
+        "\n"
+        "    mask = ((a.lazy() | b) & c - d.lazy()).evaluate()\n"
+        "\n"
+        "evaluate computes the result in one pass over all of the operands,\n"
+        "without the intermediate SpanSets that combining them directly would\n"
+        "create.  Spans that touch are joined in the result, so it may have fewer\n"
+        "spans than the equivalent direct combination, but the same pixels."
+    );
+    cls.def(py::init<py::object>(), "operand"_a);
+    cls.def("evaluate", &PyExpression::evaluate, py::return_value_policy::copy);
+    wrap_expression_op(cls, "__or__", "__ror__",
+                       [](SpanSetExpression const & a, SpanSetExpression const & b) { return a | b; });
+    wrap_expression_op(cls, "__and__", "__rand__",
+                       [](SpanSetExpression const & a, SpanSetExpression const & b) { return a & b; });
+    wrap_expression_op(cls, "__sub__", "__rsub__",
+                       [](SpanSetExpression const & a, SpanSetExpression const & b) { return a - b; });
+    wrap_expression_op(cls, "__xor__", "__rxor__",
+                       [](SpanSetExpression const & a, SpanSetExpression const & b) { return a ^ b; });
+}
+
+void declareStreamingExtractor(py::module & mod) {
+    py::class_<StreamingExtractor> cls(
+        mod, "StreamingExtractor",
+        "Extract a SpanSet from an image fed in pieces, e.g. blocks of rows read\n"
+        "from a memory-mapped file:\n"
+        "\n"
+        "    extractor = StreamingExtractor()\n"
+        "    for y0 in range(0, data.shape[0], 256):\n"
+        "        extractor.feed_greater(data[y0:y0 + 256], threshold, y0=y0)\n"
+        "        yield extractor.pop()\n"
+        "    yield extractor.finish()\n"
+        "\n"
+        "Pieces are fed in bands of rows, top to bottom; the pieces of a band\n"
+        "must all cover the band's rows and go left to right.  pop returns the\n"
+        "spans of the bands completed so far, and finish the rest."
+    );
+    auto const release_gil = py::call_guard<py::gil_scoped_release>();
+    cls
+        .def(py::init<>())
+        .def("pop", &StreamingExtractor::pop, release_gil)
+        .def("finish", &StreamingExtractor::finish, release_gil)
+    ;
+    wrap_feed_ops<bool>(cls);
+    wrap_feed_ops<std::uint8_t>(cls);
+    wrap_feed_ops<std::int8_t>(cls);
+    wrap_feed_ops<std::uint16_t>(cls);
+    wrap_feed_ops<std::int16_t>(cls);
+    wrap_feed_ops<std::uint32_t>(cls);
+    wrap_feed_ops<std::int32_t>(cls);
+    wrap_feed_ops<std::uint64_t>(cls);
+    wrap_feed_ops<std::int64_t>(cls);
+    wrap_feed_ops<float>(cls);
+    wrap_feed_ops<double>(cls);
+    wrap_feed_comparisons<std::uint8_t>(cls);
+    wrap_feed_comparisons<std::int8_t>(cls);
+    wrap_feed_comparisons<std::uint16_t>(cls);
+    wrap_feed_comparisons<std::int16_t>(cls);
+    wrap_feed_comparisons<std::uint32_t>(cls);
+    wrap_feed_comparisons<std::int32_t>(cls);
+    wrap_feed_comparisons<std::uint64_t>(cls);
+    wrap_feed_comparisons<std::int64_t>(cls);
+    wrap_feed_comparisons<float>(cls);
+    wrap_feed_comparisons<double>(cls);
+    wrap_feed_bits<std::uint8_t>(cls);
+    wrap_feed_bits<std::uint16_t>(cls);
+    wrap_feed_bits<std::uint32_t>(cls);
+    wrap_feed_bits<std::uint64_t>(cls);
+}
+
 } // anonymous
 } // spanops
 
 
 PYBIND11_MODULE(spanops, m) {
+    spanops::declareStats(m);
     spanops::declareInterval(m);
     spanops::declareSpan(m);
     spanops::declareBox(m);
+    spanops::declareConnectivity(m);
+    spanops::declareInsertMode(m);
+    spanops::declarePixelStats(m);
     spanops::declareSpanSet(m);
+    spanops::declareCompactSpanSet(m);
+    spanops::declareSpanSetCollection(m);
+    spanops::declareSpanSetIndex(m);
+    spanops::declareSpanSetArchive(m);
+    spanops::declareSpanSetExpression(m);
+    spanops::declareStreamingExtractor(m);
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
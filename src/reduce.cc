@@ -0,0 +1,22 @@
+#include "kernels.h"
+
+namespace spanops {
+
+#define INSTANTIATE(T)                                                  \
+    template PixelStats SpanSet::reduce(ImageWrapper<T const> const &) const; \
+    template std::vector<PixelStats> SpanSet::reduce_all(               \
+        std::vector<SpanSet const *> const &, ImageWrapper<T const> const &, int)
+
+INSTANTIATE(bool);
+INSTANTIATE(std::uint8_t);
+INSTANTIATE(std::int8_t);
+INSTANTIATE(std::uint16_t);
+INSTANTIATE(std::int16_t);
+INSTANTIATE(std::uint32_t);
+INSTANTIATE(std::int32_t);
+INSTANTIATE(std::uint64_t);
+INSTANTIATE(std::int64_t);
+INSTANTIATE(float);
+INSTANTIATE(double);
+
+} // namespace spanops
@@ -0,0 +1,119 @@
+#include "simd.h"
+
+#if defined(_MSC_VER) && defined(SPANOPS_HAVE_AVX2)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace spanops {
+namespace detail {
+
+namespace {
+
+#ifdef SPANOPS_HAVE_AVX2
+bool cpu_has_avx2() {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool const osxsave = (info[2] & (1 << 27)) != 0;
+    bool const avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+} // anonymous
+
+template <typename T, typename Pred>
+RowMaskFunction<T, Pred> select_row_mask() {
+#ifndef SPANOPS_NO_SIMD
+#ifdef SPANOPS_HAVE_AVX2
+    static bool const avx2 = cpu_has_avx2();
+    if (avx2) {
+        return &avx2_row_mask<T, Pred>;
+    }
+#endif
+#ifdef SPANOPS_HAVE_SSE2
+    return &vector_row_mask<Sse2Ops<T>, T, Pred>;
+#endif
+#endif
+    return nullptr;
+}
+
+template <typename T>
+InsertFunction<T> select_insert() {
+#ifndef SPANOPS_NO_SIMD
+#ifdef SPANOPS_HAVE_AVX2
+    static bool const avx2 = cpu_has_avx2();
+    if (avx2) {
+        return &avx2_insert<T>;
+    }
+#endif
+#ifdef SPANOPS_HAVE_SSE2
+    return &vector_insert<Sse2Ops<T>, T>;
+#endif
+#endif
+    return nullptr;
+}
+
+#define INSTANTIATE_INSERT(T) \
+    template InsertFunction<T> select_insert<T>()
+
+#define INSTANTIATE_PREDICATE(T, Pred) \
+    template RowMaskFunction<T, Pred<T>> select_row_mask<T, Pred<T>>()
+
+#define INSTANTIATE_COMPARISONS(T)              \
+    INSTANTIATE_PREDICATE(T, Equal);            \
+    INSTANTIATE_PREDICATE(T, Greater);          \
+    INSTANTIATE_PREDICATE(T, GreaterEqual);     \
+    INSTANTIATE_PREDICATE(T, Less);             \
+    INSTANTIATE_PREDICATE(T, LessEqual);        \
+    INSTANTIATE_PREDICATE(T, InRange)
+
+#define INSTANTIATE_BITS(T)                     \
+    INSTANTIATE_PREDICATE(T, AnyBits);          \
+    INSTANTIATE_PREDICATE(T, AllBits)
+
+INSTANTIATE_PREDICATE(bool, Equal);
+INSTANTIATE_COMPARISONS(std::uint8_t);
+INSTANTIATE_COMPARISONS(std::int8_t);
+INSTANTIATE_COMPARISONS(std::uint16_t);
+INSTANTIATE_COMPARISONS(std::int16_t);
+INSTANTIATE_COMPARISONS(std::uint32_t);
+INSTANTIATE_COMPARISONS(std::int32_t);
+INSTANTIATE_COMPARISONS(std::uint64_t);
+INSTANTIATE_COMPARISONS(std::int64_t);
+INSTANTIATE_COMPARISONS(float);
+INSTANTIATE_COMPARISONS(double);
+INSTANTIATE_BITS(std::uint8_t);
+INSTANTIATE_BITS(std::uint16_t);
+INSTANTIATE_BITS(std::uint32_t);
+INSTANTIATE_BITS(std::uint64_t);
+
+INSTANTIATE_INSERT(bool);
+INSTANTIATE_INSERT(std::uint8_t);
+INSTANTIATE_INSERT(std::int8_t);
+INSTANTIATE_INSERT(std::uint16_t);
+INSTANTIATE_INSERT(std::int16_t);
+INSTANTIATE_INSERT(std::uint32_t);
+INSTANTIATE_INSERT(std::int32_t);
+INSTANTIATE_INSERT(std::uint64_t);
+INSTANTIATE_INSERT(std::int64_t);
+INSTANTIATE_INSERT(float);
+INSTANTIATE_INSERT(double);
+
+} // namespace detail
+} // namespace spanops
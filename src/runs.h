@@ -0,0 +1,289 @@
+#ifndef SPANOPS_RUNS_H_INCLUDED
+#define SPANOPS_RUNS_H_INCLUDED
+
+// Run detection for the operations that scan images, and the inverse: writing
+// spans into images.
+//
+// Each row is first reduced to a bitmask with one bit per pixel that
+// satisfies a predicate, 64 pixels to a word, and the run boundaries are then
+// found by scanning those words with trailing-zero counts.  Building the
+// bitmask is the only part that touches pixel data, so that's the part with
+// vectorized implementations (see simd.h); which one is used is decided at
+// runtime by select_row_mask.  Insertion kernels are chosen the same way, by
+// select_insert.  Everything but those two is defined here, so the image
+// operations in kernels.h can be instantiated for any pixel type.
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "spanops.h"
+
+namespace spanops {
+namespace detail {
+
+// Signature of a vectorized row-mask kernel: set the bits for as many whole
+// 64-pixel words of 'row' as it can handle, and return the number of pixels
+// processed (always a multiple of 64).
+template <typename T, typename Pred>
+using RowMaskFunction = int (*)(T const * row, int width, Pred const & pred, std::uint64_t * bits);
+
+// Return the best row-mask kernel supported by the current CPU, or null if
+// none are available and the plain scalar loop should be used instead.
+template <typename T, typename Pred>
+RowMaskFunction<T, Pred> select_row_mask();
+
+// Signature of a vectorized insertion kernel: combine 'value' with as many
+// leading pixels of 'row' as fill whole vectors, according to 'mode', and
+// return the number of pixels processed.
+template <typename T>
+using InsertFunction = int (*)(T * row, int width, T value, InsertMode mode);
+
+// Return the best insertion kernel supported by the current CPU, or null.
+template <typename T>
+InsertFunction<T> select_insert();
+
+// Whether runs.cc instantiates select_row_mask<T, Pred> and select_insert<T>:
+// true for the pixel types and predicates the library is built for (see
+// spanops.h).  Other combinations, which only arise when kernels.h is used to
+// instantiate the image operations for new types, get the scalar loops.
+template <typename T>
+struct IsLibraryPixel : std::false_type {};
+
+template <> struct IsLibraryPixel<bool> : std::true_type {};
+template <> struct IsLibraryPixel<std::uint8_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::int8_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::uint16_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::int16_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::uint32_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::int32_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::uint64_t> : std::true_type {};
+template <> struct IsLibraryPixel<std::int64_t> : std::true_type {};
+template <> struct IsLibraryPixel<float> : std::true_type {};
+template <> struct IsLibraryPixel<double> : std::true_type {};
+
+template <typename T>
+using IsLibraryNumber = std::integral_constant<
+    bool, IsLibraryPixel<T>::value && !std::is_same<T, bool>::value
+>;
+
+template <typename T>
+using IsLibraryUnsigned = std::integral_constant<
+    bool, IsLibraryNumber<T>::value && std::is_unsigned<T>::value
+>;
+
+template <typename T, typename Pred>
+struct HasRowMask : std::false_type {};
+
+template <typename T> struct HasRowMask<T, Equal<T>> : IsLibraryPixel<T> {};
+template <typename T> struct HasRowMask<T, Greater<T>> : IsLibraryNumber<T> {};
+template <typename T> struct HasRowMask<T, GreaterEqual<T>> : IsLibraryNumber<T> {};
+template <typename T> struct HasRowMask<T, Less<T>> : IsLibraryNumber<T> {};
+template <typename T> struct HasRowMask<T, LessEqual<T>> : IsLibraryNumber<T> {};
+template <typename T> struct HasRowMask<T, InRange<T>> : IsLibraryNumber<T> {};
+template <typename T> struct HasRowMask<T, AnyBits<T>> : IsLibraryUnsigned<T> {};
+template <typename T> struct HasRowMask<T, AllBits<T>> : IsLibraryUnsigned<T> {};
+
+template <typename T, typename Pred>
+RowMaskFunction<T, Pred> row_mask_kernel(std::true_type) {
+    return select_row_mask<T, Pred>();
+}
+
+template <typename T, typename Pred>
+RowMaskFunction<T, Pred> row_mask_kernel(std::false_type) {
+    return nullptr;
+}
+
+// The row-mask kernel to use for T and Pred, or null.
+template <typename T, typename Pred>
+RowMaskFunction<T, Pred> row_mask_kernel() {
+    return row_mask_kernel<T, Pred>(HasRowMask<T, Pred>());
+}
+
+template <typename T>
+InsertFunction<T> insert_kernel(std::true_type) {
+    return select_insert<T>();
+}
+
+template <typename T>
+InsertFunction<T> insert_kernel(std::false_type) {
+    return nullptr;
+}
+
+// The insertion kernel to use for T, or null.
+template <typename T>
+InsertFunction<T> insert_kernel() {
+    return insert_kernel<T>(IsLibraryPixel<T>());
+}
+
+#ifdef SPANOPS_HAVE_AVX2
+template <typename T, typename Pred>
+int avx2_row_mask(T const * row, int width, Pred const & pred, std::uint64_t * bits);
+
+template <typename T>
+int avx2_insert(T * row, int width, T value, InsertMode mode);
+#endif
+
+inline int count_trailing_zeros(std::uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int n = 0;
+    while (!(word & 1u)) {
+        word >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// Bits [0, n) set, for 0 <= n < 64.
+inline std::uint64_t low_bits(int n) {
+    return (std::uint64_t(1) << n) - 1u;
+}
+
+// Append a Span for each run of set bits in 'bits', which covers 'width'
+// pixels starting at column x0 of row y.  Bits past 'width' must be zero.
+inline void append_runs(
+    std::uint64_t const * bits, int width, int x0, int y,
+    std::vector<Span> & spans
+) {
+    bool in_run = false;
+    int start = 0;
+    for (int base = 0; base < width; base += 64, ++bits) {
+        std::uint64_t word = *bits;
+        std::uint64_t valid = (width - base >= 64) ? ~std::uint64_t(0) : low_bits(width - base);
+        while (true) {
+            if (in_run) {
+                std::uint64_t gaps = ~word & valid;
+                if (!gaps) break;
+                int k = count_trailing_zeros(gaps);
+                spans.emplace_back(Interval(x0 + start, x0 + base + k - 1), y);
+                in_run = false;
+                word &= ~low_bits(k);
+                valid &= ~low_bits(k);
+            } else {
+                if (!word) break;
+                int k = count_trailing_zeros(word);
+                start = base + k;
+                in_run = true;
+                valid &= ~low_bits(k);
+            }
+        }
+    }
+    if (in_run) {
+        spans.emplace_back(Interval(x0 + start, x0 + width - 1), y);
+    }
+}
+
+// Append the runs of pixels satisfying 'pred' in the given rows of 'image'
+// (which must be a subset of image.bbox.y()) to 'spans', in sorted order.
+template <typename T, typename Pred>
+void scan_rows(
+    ImageWrapper<T const> const & image, Pred const & pred, Interval const & rows,
+    std::vector<Span> & spans
+) {
+    if (image.bbox.empty() || rows.empty()) {
+        return;
+    }
+    int const width = image.bbox.width();
+    T const * py = image.ptr + image.stride*(rows.min() - image.bbox.y0());
+    RowMaskFunction<T, Pred> row_mask = row_mask_kernel<T, Pred>();
+    if (!row_mask) {
+        for (int y = rows.min(); y <= rows.max(); ++y) {
+            T const * p = py;
+            int x = image.bbox.x0();
+            while (x <= image.bbox.x1()) {
+                if (pred(*p)) {
+                    int x0 = x;
+                    while (true) {
+                        ++x;
+                        ++p;
+                        if (x > image.bbox.x1() || !pred(*p)) {
+                            spans.emplace_back(Interval(x0, x - 1), y);
+                            break;
+                        }
+                    }
+                }
+                ++x;
+                ++p;
+            }
+            py += image.stride;
+        }
+        return;
+    }
+    std::vector<std::uint64_t> bits((width + 63)/64, 0u);
+    for (int y = rows.min(); y <= rows.max(); ++y) {
+        int n = row_mask(py, width, pred, bits.data());
+        if (n < width) {
+            std::uint64_t tail = 0u;
+            for (int i = n; i < width; ++i) {
+                tail |= std::uint64_t(pred(py[i])) << (i - n);
+            }
+            bits[n/64] = tail;
+        }
+        append_runs(bits.data(), width, image.bbox.x0(), y, spans);
+        py += image.stride;
+    }
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, T>::type bit_or(T a, T b) {
+    return a | b;
+}
+
+// Never called: SpanSet::insert rejects InsertMode::OR for floating-point
+// images before getting here.
+template <typename T>
+typename std::enable_if<!std::is_integral<T>::value, T>::type bit_or(T a, T) {
+    return a;
+}
+
+// Check that 'mode' can be used with images of T, and return the mode to
+// actually use: anything but ASSIGN is OR for bool images.  Throws
+// std::invalid_argument for InsertMode::OR with a floating-point T.
+template <typename T>
+InsertMode resolve_insert_mode(InsertMode mode) {
+    if (mode == InsertMode::OR && std::is_floating_point<T>::value) {
+        throw std::invalid_argument("InsertMode::OR requires an integer image");
+    }
+    if (std::is_same<T, bool>::value && mode != InsertMode::ASSIGN) {
+        return InsertMode::OR;
+    }
+    return mode;
+}
+
+// Combine 'value' with the 'width' pixels starting at 'row' according to
+// 'mode', using 'kernel' (if not null) for as many of them as it handles.
+template <typename T>
+void insert_span(T * row, int width, T value, InsertMode mode, InsertFunction<T> kernel) {
+    T * first = row + (kernel ? kernel(row, width, value, mode) : 0);
+    T * const last = row + width;
+    switch (mode) {
+    case InsertMode::ADD:
+        for (; first != last; ++first) {
+            *first = *first + value;
+        }
+        break;
+    case InsertMode::ASSIGN:
+        std::fill(first, last, value);
+        break;
+    case InsertMode::OR:
+        for (; first != last; ++first) {
+            *first = bit_or(*first, value);
+        }
+        break;
+    case InsertMode::MAX:
+        for (; first != last; ++first) {
+            *first = std::max(*first, value);
+        }
+        break;
+    }
+}
+
+} // namespace detail
+} // namespace spanops
+
+#endif // !SPANOPS_RUNS_H_INCLUDED
@@ -0,0 +1,67 @@
+// This file is compiled with AVX2 enabled, and its kernels are only called
+// after select_row_mask or select_insert has checked that the CPU supports
+// them.
+
+#include "simd.h"
+
+namespace spanops {
+namespace detail {
+
+template <typename T, typename Pred>
+int avx2_row_mask(T const * row, int width, Pred const & pred, std::uint64_t * bits) {
+    return vector_row_mask<Avx2Ops<T>>(row, width, pred, bits);
+}
+
+template <typename T>
+int avx2_insert(T * row, int width, T value, InsertMode mode) {
+    return vector_insert<Avx2Ops<T>>(row, width, value, mode);
+}
+
+#define INSTANTIATE_INSERT(T) \
+    template int avx2_insert(T *, int, T, InsertMode)
+
+#define INSTANTIATE_PREDICATE(T, Pred) \
+    template int avx2_row_mask(T const *, int, Pred<T> const &, std::uint64_t *)
+
+#define INSTANTIATE_COMPARISONS(T)              \
+    INSTANTIATE_PREDICATE(T, Equal);            \
+    INSTANTIATE_PREDICATE(T, Greater);          \
+    INSTANTIATE_PREDICATE(T, GreaterEqual);     \
+    INSTANTIATE_PREDICATE(T, Less);             \
+    INSTANTIATE_PREDICATE(T, LessEqual);        \
+    INSTANTIATE_PREDICATE(T, InRange)
+
+#define INSTANTIATE_BITS(T)                     \
+    INSTANTIATE_PREDICATE(T, AnyBits);          \
+    INSTANTIATE_PREDICATE(T, AllBits)
+
+INSTANTIATE_PREDICATE(bool, Equal);
+INSTANTIATE_COMPARISONS(std::uint8_t);
+INSTANTIATE_COMPARISONS(std::int8_t);
+INSTANTIATE_COMPARISONS(std::uint16_t);
+INSTANTIATE_COMPARISONS(std::int16_t);
+INSTANTIATE_COMPARISONS(std::uint32_t);
+INSTANTIATE_COMPARISONS(std::int32_t);
+INSTANTIATE_COMPARISONS(std::uint64_t);
+INSTANTIATE_COMPARISONS(std::int64_t);
+INSTANTIATE_COMPARISONS(float);
+INSTANTIATE_COMPARISONS(double);
+INSTANTIATE_BITS(std::uint8_t);
+INSTANTIATE_BITS(std::uint16_t);
+INSTANTIATE_BITS(std::uint32_t);
+INSTANTIATE_BITS(std::uint64_t);
+
+INSTANTIATE_INSERT(bool);
+INSTANTIATE_INSERT(std::uint8_t);
+INSTANTIATE_INSERT(std::int8_t);
+INSTANTIATE_INSERT(std::uint16_t);
+INSTANTIATE_INSERT(std::int16_t);
+INSTANTIATE_INSERT(std::uint32_t);
+INSTANTIATE_INSERT(std::int32_t);
+INSTANTIATE_INSERT(std::uint64_t);
+INSTANTIATE_INSERT(std::int64_t);
+INSTANTIATE_INSERT(float);
+INSTANTIATE_INSERT(double);
+
+} // namespace detail
+} // namespace spanops
@@ -0,0 +1,240 @@
+// Binary encoding of SpanSets.
+//
+// A single SpanSet is encoded as a sequence of unsigned LEB128 varints, with
+// signed values zigzag-encoded first:
+//
+//     n                           number of spans
+//     y, x0, x1 - x0              first span; y and x0 signed
+//     dy, dx, x1 - x0             each following span, where dy is the number
+//                                 of rows since the previous span, and dx is
+//                                 x0 - (previous x1 + 1) if dy == 0, or the
+//                                 signed x0 - previous x0 otherwise
+//
+// so a typical span takes three or four bytes.  Any data that decodes without
+// running out of bytes or leaving the int range is a valid SpanSet.
+//
+// An archive of many SpanSets is
+//
+//     "SPANARC1"                  8-byte magic
+//     records                     encoded SpanSets, back to back
+//     offsets[count + 1]          uint64 offset of each record from the start
+//                                 of the archive, then the end of the last one
+//     count                       uint64
+//     "SPANARC1"
+//
+// with all fixed-size integers little-endian.  The index is at the end so a
+// writer can stream records out without knowing how many there will be.
+
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+
+#include "spanops.h"
+#include "stats.h"
+
+namespace spanops {
+
+namespace {
+
+char const magic[8] = {'S', 'P', 'A', 'N', 'A', 'R', 'C', '1'};
+
+std::uint64_t zigzag(std::int64_t v) {
+    return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
+
+std::int64_t unzigzag(std::uint64_t v) {
+    return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1u);
+}
+
+void put_varint(std::vector<std::uint8_t> & out, std::uint64_t v) {
+    while (v >= 0x80u) {
+        out.push_back(static_cast<std::uint8_t>(v | 0x80u));
+        v >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(v));
+}
+
+void put_uint64(std::ostream & stream, std::uint64_t v) {
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<char>((v >> (8*i)) & 0xffu);
+    }
+    stream.write(bytes, 8);
+}
+
+std::uint64_t get_uint64(std::uint8_t const * p) {
+    std::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v |= std::uint64_t(p[i]) << (8*i);
+    }
+    return v;
+}
+
+class Decoder {
+public:
+
+    Decoder(std::uint8_t const * data, std::size_t size) : _p(data), _end(data + size) {}
+
+    std::uint64_t varint() {
+        std::uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (_p == _end) {
+                throw std::invalid_argument("Truncated SpanSet data");
+            }
+            std::uint8_t const byte = *_p++;
+            v |= std::uint64_t(byte & 0x7fu) << shift;
+            if (!(byte & 0x80u)) {
+                return v;
+            }
+        }
+        throw std::invalid_argument("Malformed varint in SpanSet data");
+    }
+
+    // Decode a coordinate: 'base' plus a signed or unsigned delta.
+    int coordinate(std::int64_t base, bool is_signed) {
+        std::uint64_t const raw = varint();
+        // No valid delta needs more than 33 bits, even zigzag-encoded; this
+        // also keeps the sum below from overflowing.
+        if (raw >> 33) {
+            throw std::invalid_argument("Coordinate out of range in SpanSet data");
+        }
+        std::int64_t const v = base + (is_signed ? unzigzag(raw) : static_cast<std::int64_t>(raw));
+        if (v < std::numeric_limits<int>::min() || v > std::numeric_limits<int>::max()) {
+            throw std::invalid_argument("Coordinate out of range in SpanSet data");
+        }
+        return static_cast<int>(v);
+    }
+
+    bool done() const { return _p == _end; }
+
+private:
+    std::uint8_t const * _p;
+    std::uint8_t const * _end;
+};
+
+} // anonymous
+
+std::vector<std::uint8_t> SpanSet::to_bytes() const {
+    detail::OperationTimer timer(Operation::TO_BYTES);
+    timer.spans_in(size());
+    std::vector<std::uint8_t> out;
+    out.reserve(1 + 3*size());
+    put_varint(out, size());
+    Span const * prev = nullptr;
+    for (auto const & span : _spans) {
+        if (!prev) {
+            put_varint(out, zigzag(span.y()));
+            put_varint(out, zigzag(span.x0()));
+        } else {
+            std::int64_t const dy = std::int64_t(span.y()) - prev->y();
+            put_varint(out, dy);
+            if (dy == 0) {
+                put_varint(out, std::int64_t(span.x0()) - prev->x1() - 1);
+            } else {
+                put_varint(out, zigzag(std::int64_t(span.x0()) - prev->x0()));
+            }
+        }
+        put_varint(out, std::int64_t(span.x1()) - span.x0());
+        prev = &span;
+    }
+    timer.bytes(out.capacity());
+    return out;
+}
+
+SpanSet SpanSet::from_bytes(std::uint8_t const * data, std::size_t size) {
+    detail::OperationTimer timer(Operation::FROM_BYTES);
+    Decoder decoder(data, size);
+    std::uint64_t const n = decoder.varint();
+    // Every span takes at least three bytes, which bounds the reservation.
+    if (n > size/3) {
+        throw std::invalid_argument("Truncated SpanSet data");
+    }
+    std::vector<Span> spans;
+    spans.reserve(n);
+    for (std::uint64_t i = 0; i < n; ++i) {
+        int y, x0;
+        if (i == 0) {
+            y = decoder.coordinate(0, true);
+            x0 = decoder.coordinate(0, true);
+        } else {
+            Span const & prev = spans.back();
+            y = decoder.coordinate(prev.y(), false);
+            if (y == prev.y()) {
+                x0 = decoder.coordinate(std::int64_t(prev.x1()) + 1, false);
+            } else {
+                x0 = decoder.coordinate(prev.x0(), true);
+            }
+        }
+        int const x1 = decoder.coordinate(x0, false);
+        spans.emplace_back(Interval(x0, x1), y);
+    }
+    if (!decoder.done()) {
+        throw std::invalid_argument("Trailing bytes after SpanSet data");
+    }
+    timer.output(spans);
+    return SpanSet(std::move(spans));
+}
+
+SpanSetArchiveWriter::SpanSetArchiveWriter(std::ostream & stream) :
+    _stream(stream), _offsets(1, sizeof(magic)), _closed(false)
+{
+    _stream.write(magic, sizeof(magic));
+}
+
+void SpanSetArchiveWriter::write(SpanSet const & set) {
+    if (_closed) {
+        throw std::logic_error("SpanSetArchiveWriter is closed");
+    }
+    std::vector<std::uint8_t> const bytes = set.to_bytes();
+    _stream.write(reinterpret_cast<char const *>(bytes.data()), bytes.size());
+    _offsets.push_back(_offsets.back() + bytes.size());
+}
+
+void SpanSetArchiveWriter::close() {
+    if (_closed) {
+        return;
+    }
+    for (auto offset : _offsets) {
+        put_uint64(_stream, offset);
+    }
+    put_uint64(_stream, _offsets.size() - 1);
+    _stream.write(magic, sizeof(magic));
+    _stream.flush();
+    _closed = true;
+    if (!_stream) {
+        throw std::runtime_error("Failed to write SpanSet archive");
+    }
+}
+
+SpanSetArchive::SpanSetArchive(void const * data, std::size_t size) :
+    _data(static_cast<std::uint8_t const *>(data)), _offsets(nullptr), _records_size(0), _count(0)
+{
+    std::size_t const trailer = 8 + sizeof(magic);
+    if (size < sizeof(magic) + 8 + trailer ||
+        std::memcmp(_data, magic, sizeof(magic)) != 0 ||
+        std::memcmp(_data + size - sizeof(magic), magic, sizeof(magic)) != 0) {
+        throw std::invalid_argument("Not a SpanSet archive");
+    }
+    std::uint64_t const count = get_uint64(_data + size - trailer);
+    if (count >= (size - sizeof(magic) - trailer)/8) {
+        throw std::invalid_argument("Corrupt SpanSet archive index");
+    }
+    _count = count;
+    _records_size = size - trailer - 8*(_count + 1);
+    _offsets = _data + _records_size;
+}
+
+SpanSet SpanSetArchive::operator[](std::size_t i) const {
+    if (i >= _count) {
+        throw std::out_of_range("SpanSet archive index out of range");
+    }
+    std::uint64_t const first = get_uint64(_offsets + 8*i);
+    std::uint64_t const last = get_uint64(_offsets + 8*(i + 1));
+    if (first < sizeof(magic) || first > last || last > _records_size) {
+        throw std::invalid_argument("Corrupt SpanSet archive index");
+    }
+    return SpanSet::from_bytes(_data + first, last - first);
+}
+
+} // namespace spanops
@@ -0,0 +1,468 @@
+#ifndef SPANOPS_SIMD_H_INCLUDED
+#define SPANOPS_SIMD_H_INCLUDED
+
+// Vectorized row-mask and span insertion kernels (see runs.h).
+//
+// This header is included both by runs.cc, which is compiled for the baseline
+// instruction set and instantiates the SSE2 kernels, and by runs_avx2.cc,
+// which is compiled with AVX2 enabled.  Everything here is in an anonymous
+// namespace so code generated for one instruction set can never be merged by
+// the linker with code generated for another.
+
+#include <cstdint>
+#include <type_traits>
+
+#include "runs.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPANOPS_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace spanops {
+namespace detail {
+namespace {
+
+// Compress the even bits of a movemask result (two bits per 16-bit lane) into
+// one bit per lane.
+inline unsigned compact_pairs(unsigned m) {
+    m &= 0x55555555u;
+    m = (m | (m >> 1)) & 0x33333333u;
+    m = (m | (m >> 2)) & 0x0f0f0f0fu;
+    m = (m | (m >> 4)) & 0x00ff00ffu;
+    m = (m | (m >> 8)) & 0x0000ffffu;
+    return m;
+}
+
+// Per-instruction-set lane operations.  Comparisons return a bitmask with one
+// bit per lane, except gt_vec, which returns a vector with all bits of each
+// lane set where a > b.  max(a, b) has the semantics of std::max.
+template <typename T,
+          std::size_t Size = sizeof(T),
+          bool Float = std::is_floating_point<T>::value>
+struct Sse2Ops;
+
+template <typename T,
+          std::size_t Size = sizeof(T),
+          bool Float = std::is_floating_point<T>::value>
+struct Avx2Ops;
+
+#ifdef SPANOPS_HAVE_SSE2
+
+// Integer comparisons are signed in SSE2, so unsigned lanes are compared
+// after flipping their sign bits.
+template <typename T>
+struct Sse2Ops<T, 1, false> {
+    using vec = __m128i;
+    static int const lanes = 16;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm_set1_epi8(static_cast<char>(v)); }
+    static vec load(T const * p) { return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)); }
+    static vec zero() { return _mm_setzero_si128(); }
+    static vec bit_and(vec a, vec b) { return _mm_and_si128(a, b); }
+    static vec bias() { return std::is_signed<T>::value ? _mm_setzero_si128() : _mm_set1_epi8(-128); }
+    static unsigned mask(vec c) { return _mm_movemask_epi8(c); }
+    static unsigned eq(vec a, vec b) { return mask(_mm_cmpeq_epi8(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm_cmpgt_epi8(_mm_xor_si128(a, bias()), _mm_xor_si128(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm_add_epi8(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm_or_si128(a, b); }
+    static vec max(vec a, vec b) {
+        vec const c = gt_vec(b, a);
+        return _mm_or_si128(_mm_and_si128(c, b), _mm_andnot_si128(c, a));
+    }
+};
+
+template <typename T>
+struct Sse2Ops<T, 2, false> {
+    using vec = __m128i;
+    static int const lanes = 8;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm_set1_epi16(static_cast<short>(v)); }
+    static vec load(T const * p) { return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)); }
+    static vec zero() { return _mm_setzero_si128(); }
+    static vec bit_and(vec a, vec b) { return _mm_and_si128(a, b); }
+    static vec bias() {
+        return std::is_signed<T>::value ? _mm_setzero_si128() : _mm_set1_epi16(-32768);
+    }
+    static unsigned mask(vec c) { return compact_pairs(_mm_movemask_epi8(c)); }
+    static unsigned eq(vec a, vec b) { return mask(_mm_cmpeq_epi16(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm_cmpgt_epi16(_mm_xor_si128(a, bias()), _mm_xor_si128(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm_add_epi16(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm_or_si128(a, b); }
+    static vec max(vec a, vec b) {
+        vec const c = gt_vec(b, a);
+        return _mm_or_si128(_mm_and_si128(c, b), _mm_andnot_si128(c, a));
+    }
+};
+
+template <typename T>
+struct Sse2Ops<T, 4, false> {
+    using vec = __m128i;
+    static int const lanes = 4;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm_set1_epi32(static_cast<int>(v)); }
+    static vec load(T const * p) { return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)); }
+    static vec zero() { return _mm_setzero_si128(); }
+    static vec bit_and(vec a, vec b) { return _mm_and_si128(a, b); }
+    static vec bias() {
+        return std::is_signed<T>::value ? _mm_setzero_si128() : _mm_set1_epi32(INT32_MIN);
+    }
+    static unsigned mask(vec c) { return _mm_movemask_ps(_mm_castsi128_ps(c)); }
+    static unsigned eq(vec a, vec b) { return mask(_mm_cmpeq_epi32(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm_cmpgt_epi32(_mm_xor_si128(a, bias()), _mm_xor_si128(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm_or_si128(a, b); }
+    static vec max(vec a, vec b) {
+        vec const c = gt_vec(b, a);
+        return _mm_or_si128(_mm_and_si128(c, b), _mm_andnot_si128(c, a));
+    }
+};
+
+template <typename T>
+struct Sse2Ops<T, 8, false> {
+    using vec = __m128i;
+    static int const lanes = 2;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm_set1_epi64x(static_cast<long long>(v)); }
+    static vec load(T const * p) { return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)); }
+    static vec zero() { return _mm_setzero_si128(); }
+    static vec bit_and(vec a, vec b) { return _mm_and_si128(a, b); }
+    // movemask_pd reads the sign bit of each 64-bit lane, i.e. of its high half.
+    static unsigned mask(vec c) { return _mm_movemask_pd(_mm_castsi128_pd(c)); }
+    static unsigned eq(vec a, vec b) {
+        // SSE2 has no 64-bit compare; both 32-bit halves have to match.
+        __m128i c = _mm_cmpeq_epi32(a, b);
+        return mask(_mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1))));
+    }
+    static vec gt_vec(vec a, vec b) {
+        // Compare the high halves with the lane's signedness and the low
+        // halves as unsigned; the low result only matters when the high
+        // halves are equal.  The answer ends up in the high half of each
+        // lane, and is then copied to the low half.
+        __m128i const s = _mm_set_epi32(std::is_signed<T>::value ? 0 : INT32_MIN, INT32_MIN,
+                                        std::is_signed<T>::value ? 0 : INT32_MIN, INT32_MIN);
+        a = _mm_xor_si128(a, s);
+        b = _mm_xor_si128(b, s);
+        __m128i const g = _mm_cmpgt_epi32(a, b);
+        __m128i const e = _mm_cmpeq_epi32(a, b);
+        __m128i const g_low = _mm_shuffle_epi32(g, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128i const high = _mm_or_si128(g, _mm_and_si128(e, g_low));
+        return _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 3, 1, 1));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm_add_epi64(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm_or_si128(a, b); }
+    static vec max(vec a, vec b) {
+        vec const c = gt_vec(b, a);
+        return _mm_or_si128(_mm_and_si128(c, b), _mm_andnot_si128(c, a));
+    }
+};
+
+template <>
+struct Sse2Ops<float, 4, true> {
+    using vec = __m128;
+    static int const lanes = 4;
+    static vec set1(float v) { return _mm_set1_ps(v); }
+    static vec load(float const * p) { return _mm_loadu_ps(p); }
+    static unsigned eq(vec a, vec b) { return _mm_movemask_ps(_mm_cmpeq_ps(a, b)); }
+    static unsigned gt(vec a, vec b) { return _mm_movemask_ps(_mm_cmpgt_ps(a, b)); }
+    static unsigned ge(vec a, vec b) { return _mm_movemask_ps(_mm_cmpge_ps(a, b)); }
+    static void store(float * p, vec v) { _mm_storeu_ps(p, v); }
+    static vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm_or_ps(a, b); }
+    // Same as std::max(a, b), which returns a unless a < b (so NaNs in a are
+    // kept); _mm_max_ps differs for NaNs.
+    static vec max(vec a, vec b) {
+        vec const c = _mm_cmplt_ps(a, b);
+        return _mm_or_ps(_mm_and_ps(c, b), _mm_andnot_ps(c, a));
+    }
+};
+
+template <>
+struct Sse2Ops<double, 8, true> {
+    using vec = __m128d;
+    static int const lanes = 2;
+    static vec set1(double v) { return _mm_set1_pd(v); }
+    static vec load(double const * p) { return _mm_loadu_pd(p); }
+    static unsigned eq(vec a, vec b) { return _mm_movemask_pd(_mm_cmpeq_pd(a, b)); }
+    static unsigned gt(vec a, vec b) { return _mm_movemask_pd(_mm_cmpgt_pd(a, b)); }
+    static unsigned ge(vec a, vec b) { return _mm_movemask_pd(_mm_cmpge_pd(a, b)); }
+    static void store(double * p, vec v) { _mm_storeu_pd(p, v); }
+    static vec add(vec a, vec b) { return _mm_add_pd(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm_or_pd(a, b); }
+    // See the float version.
+    static vec max(vec a, vec b) {
+        vec const c = _mm_cmplt_pd(a, b);
+        return _mm_or_pd(_mm_and_pd(c, b), _mm_andnot_pd(c, a));
+    }
+};
+
+#endif // SPANOPS_HAVE_SSE2
+
+#ifdef __AVX2__
+
+template <typename T>
+struct Avx2Ops<T, 1, false> {
+    using vec = __m256i;
+    static int const lanes = 32;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm256_set1_epi8(static_cast<char>(v)); }
+    static vec load(T const * p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)); }
+    static vec zero() { return _mm256_setzero_si256(); }
+    static vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static vec bias() { return std::is_signed<T>::value ? _mm256_setzero_si256() : _mm256_set1_epi8(-128); }
+    static unsigned mask(vec c) { return static_cast<unsigned>(_mm256_movemask_epi8(c)); }
+    static unsigned eq(vec a, vec b) { return mask(_mm256_cmpeq_epi8(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm256_cmpgt_epi8(_mm256_xor_si256(a, bias()), _mm256_xor_si256(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm256_add_epi8(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static vec max(vec a, vec b) { return _mm256_blendv_epi8(a, b, gt_vec(b, a)); }
+};
+
+template <typename T>
+struct Avx2Ops<T, 2, false> {
+    using vec = __m256i;
+    static int const lanes = 16;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm256_set1_epi16(static_cast<short>(v)); }
+    static vec load(T const * p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)); }
+    static vec zero() { return _mm256_setzero_si256(); }
+    static vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static vec bias() {
+        return std::is_signed<T>::value ? _mm256_setzero_si256() : _mm256_set1_epi16(-32768);
+    }
+    static unsigned mask(vec c) { return compact_pairs(static_cast<unsigned>(_mm256_movemask_epi8(c))); }
+    static unsigned eq(vec a, vec b) { return mask(_mm256_cmpeq_epi16(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm256_cmpgt_epi16(_mm256_xor_si256(a, bias()), _mm256_xor_si256(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm256_add_epi16(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static vec max(vec a, vec b) { return _mm256_blendv_epi8(a, b, gt_vec(b, a)); }
+};
+
+template <typename T>
+struct Avx2Ops<T, 4, false> {
+    using vec = __m256i;
+    static int const lanes = 8;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm256_set1_epi32(static_cast<int>(v)); }
+    static vec load(T const * p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)); }
+    static vec zero() { return _mm256_setzero_si256(); }
+    static vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static vec bias() {
+        return std::is_signed<T>::value ? _mm256_setzero_si256() : _mm256_set1_epi32(INT32_MIN);
+    }
+    static unsigned mask(vec c) { return _mm256_movemask_ps(_mm256_castsi256_ps(c)); }
+    static unsigned eq(vec a, vec b) { return mask(_mm256_cmpeq_epi32(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm256_cmpgt_epi32(_mm256_xor_si256(a, bias()), _mm256_xor_si256(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static vec max(vec a, vec b) { return _mm256_blendv_epi8(a, b, gt_vec(b, a)); }
+};
+
+template <typename T>
+struct Avx2Ops<T, 8, false> {
+    using vec = __m256i;
+    static int const lanes = 4;
+    static unsigned const full = ~0u >> (32 - lanes);
+    static vec set1(T v) { return _mm256_set1_epi64x(static_cast<long long>(v)); }
+    static vec load(T const * p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)); }
+    static vec zero() { return _mm256_setzero_si256(); }
+    static vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static vec bias() {
+        return std::is_signed<T>::value ? _mm256_setzero_si256() : _mm256_set1_epi64x(INT64_MIN);
+    }
+    static unsigned mask(vec c) { return _mm256_movemask_pd(_mm256_castsi256_pd(c)); }
+    static unsigned eq(vec a, vec b) { return mask(_mm256_cmpeq_epi64(a, b)); }
+    static vec gt_vec(vec a, vec b) {
+        return _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias()), _mm256_xor_si256(b, bias()));
+    }
+    static unsigned gt(vec a, vec b) { return mask(gt_vec(a, b)); }
+    static unsigned ge(vec a, vec b) { return ~gt(b, a) & full; }
+    static void store(T * p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+    static vec add(vec a, vec b) { return _mm256_add_epi64(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static vec max(vec a, vec b) { return _mm256_blendv_epi8(a, b, gt_vec(b, a)); }
+};
+
+template <>
+struct Avx2Ops<float, 4, true> {
+    using vec = __m256;
+    static int const lanes = 8;
+    static vec set1(float v) { return _mm256_set1_ps(v); }
+    static vec load(float const * p) { return _mm256_loadu_ps(p); }
+    static unsigned eq(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+    static unsigned gt(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+    static unsigned ge(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+    static void store(float * p, vec v) { _mm256_storeu_ps(p, v); }
+    static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_ps(a, b); }
+    static vec max(vec a, vec b) { return _mm256_blendv_ps(a, b, _mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+};
+
+template <>
+struct Avx2Ops<double, 8, true> {
+    using vec = __m256d;
+    static int const lanes = 4;
+    static vec set1(double v) { return _mm256_set1_pd(v); }
+    static vec load(double const * p) { return _mm256_loadu_pd(p); }
+    static unsigned eq(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+    static unsigned gt(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ)); }
+    static unsigned ge(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GE_OQ)); }
+    static void store(double * p, vec v) { _mm256_storeu_pd(p, v); }
+    static vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_pd(a, b); }
+    static vec max(vec a, vec b) { return _mm256_blendv_pd(a, b, _mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+};
+
+#endif // __AVX2__
+
+// Vector form of a predicate: broadcasts its parameters once, then maps a
+// vector of pixels to a lane bitmask.
+template <typename Ops, typename Pred>
+struct VectorPredicate;
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, Equal<T>> {
+    explicit VectorPredicate(Equal<T> const & pred) : value(Ops::set1(pred.value)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::eq(x, value); }
+    typename Ops::vec value;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, Greater<T>> {
+    explicit VectorPredicate(Greater<T> const & pred) : threshold(Ops::set1(pred.threshold)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::gt(x, threshold); }
+    typename Ops::vec threshold;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, GreaterEqual<T>> {
+    explicit VectorPredicate(GreaterEqual<T> const & pred) : threshold(Ops::set1(pred.threshold)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::ge(x, threshold); }
+    typename Ops::vec threshold;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, Less<T>> {
+    explicit VectorPredicate(Less<T> const & pred) : threshold(Ops::set1(pred.threshold)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::gt(threshold, x); }
+    typename Ops::vec threshold;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, LessEqual<T>> {
+    explicit VectorPredicate(LessEqual<T> const & pred) : threshold(Ops::set1(pred.threshold)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::ge(threshold, x); }
+    typename Ops::vec threshold;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, InRange<T>> {
+    explicit VectorPredicate(InRange<T> const & pred) :
+        min(Ops::set1(pred.min)), max(Ops::set1(pred.max)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::ge(x, min) & Ops::ge(max, x); }
+    typename Ops::vec min;
+    typename Ops::vec max;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, AnyBits<T>> {
+    explicit VectorPredicate(AnyBits<T> const & pred) : bits(Ops::set1(pred.bits)) {}
+    unsigned operator()(typename Ops::vec x) const {
+        return ~Ops::eq(Ops::bit_and(x, bits), Ops::zero()) & Ops::full;
+    }
+    typename Ops::vec bits;
+};
+
+template <typename Ops, typename T>
+struct VectorPredicate<Ops, AllBits<T>> {
+    explicit VectorPredicate(AllBits<T> const & pred) : bits(Ops::set1(pred.bits)) {}
+    unsigned operator()(typename Ops::vec x) const { return Ops::eq(Ops::bit_and(x, bits), bits); }
+    typename Ops::vec bits;
+};
+
+template <typename Ops, typename T, typename Pred>
+int vector_row_mask(T const * row, int width, Pred const & pred, std::uint64_t * bits) {
+    static_assert(64 % Ops::lanes == 0, "lane count must divide 64");
+    VectorPredicate<Ops, Pred> const vpred(pred);
+    int const n = width/64;
+    for (int w = 0; w < n; ++w, row += 64) {
+        std::uint64_t word = 0u;
+        for (int i = 0; i < 64/Ops::lanes; ++i) {
+            word |= std::uint64_t(vpred(Ops::load(row + i*Ops::lanes))) << (i*Ops::lanes);
+        }
+        bits[w] = word;
+    }
+    return n*64;
+}
+
+template <typename Ops, typename T>
+int vector_insert(T * row, int width, T value, InsertMode mode) {
+    typename Ops::vec const v = Ops::set1(value);
+    int const n = width - width % Ops::lanes;
+    switch (mode) {
+    case InsertMode::ADD:
+        for (int i = 0; i < n; i += Ops::lanes) {
+            Ops::store(row + i, Ops::add(Ops::load(row + i), v));
+        }
+        break;
+    case InsertMode::ASSIGN:
+        for (int i = 0; i < n; i += Ops::lanes) {
+            Ops::store(row + i, v);
+        }
+        break;
+    case InsertMode::OR:
+        for (int i = 0; i < n; i += Ops::lanes) {
+            Ops::store(row + i, Ops::bit_or(Ops::load(row + i), v));
+        }
+        break;
+    case InsertMode::MAX:
+        for (int i = 0; i < n; i += Ops::lanes) {
+            Ops::store(row + i, Ops::max(Ops::load(row + i), v));
+        }
+        break;
+    }
+    return n;
+}
+
+} // anonymous
+} // namespace detail
+} // namespace spanops
+
+#endif // !SPANOPS_SIMD_H_INCLUDED
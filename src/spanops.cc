@@ -2,6 +2,10 @@
 #include <map>
 
 #include "spanops.h"
+#include "components.h"
+#include "parallel.h"
+#include "kernels.h"
+#include "stats.h"
 
 namespace spanops {
 
@@ -165,6 +169,21 @@ SpanSet::SpanSet(Box const & box) : _spans() {
     }
 }
 
+SpanSet SpanSet::from_spans(std::vector<Span> spans) {
+    for (std::size_t i = 0; i < spans.size(); ++i) {
+        if (spans[i].empty()) {
+            throw std::invalid_argument("SpanSet may not contain empty spans");
+        }
+        if (i > 0 && !(spans[i - 1].y() < spans[i].y() ||
+                       (spans[i - 1].y() == spans[i].y() && spans[i - 1].x1() < spans[i].x0()))) {
+            throw std::invalid_argument("SpanSet spans must be sorted and non-overlapping");
+        }
+    }
+    SpanSet result;
+    result._spans.swap(spans);
+    return result;
+}
+
 int SpanSet::area() const {
     int a = 0;
     for (auto const & span : _spans) {
@@ -204,237 +223,619 @@ struct SpanStrictLess {
     }
 };
 
-template <typename Iter>
-std::vector<Span> intersect(
-    Iter i1, Iter const end1,
-    Iter i2, Iter const end2
+// The merges below write their output through 'out' and return the end of
+// it.  The output has at most as many spans as the inputs together, and
+// never gets ahead of the first input by more than the length of the second,
+// so 'out' may point into the same storage as the first input as long as it
+// starts at least that far before it (see operator|= and operator&=).
+
+template <typename Iter1, typename Iter2, typename OutIter>
+OutIter unite(
+    Iter1 i1, Iter1 const end1,
+    Iter2 i2, Iter2 const end2,
+    OutIter out
+) {
+    auto any_less = SpanAnyLess();
+    OutIter const first = out;
+    while (i1 != end1 || i2 != end2) {
+        Span next;
+        if (i2 == end2 || (i1 != end1 && !any_less(*i2, *i1))) {
+            next = *i1++;
+        } else {
+            next = *i2++;
+        }
+        if (out != first && out[-1].overlaps(next)) {
+            if (next.x1() > out[-1].x1()) {
+                out[-1] = Span(Interval(out[-1].x0(), next.x1()), next.y());
+            }
+        } else {
+            *out++ = next;
+        }
+    }
+    return out;
+}
+
+template <typename Iter1, typename Iter2, typename OutIter>
+OutIter intersect(
+    Iter1 i1, Iter1 const end1,
+    Iter2 i2, Iter2 const end2,
+    OutIter out
 ) {
-    std::vector<Span> intersection;
     auto strictly_less = SpanStrictLess();
-    if (i1 == end1 || i2 == end2) return intersection;
+    if (i1 == end1 || i2 == end2) return out;
     while (true) {
         if (strictly_less(*i1, *i2)) {
             if (++i1 == end1) break;
         } else if (strictly_less(*i2, *i1)) {
             if (++i2 == end2) break;
         } else { // they must overlap
-            intersection.push_back((*i1) & (*i2));
-            if (i1->x1() <= i2->x1()) {
+            int const x1_1 = i1->x1();
+            int const x1_2 = i2->x1();
+            *out++ = (*i1) & (*i2);
+            if (x1_1 <= x1_2) {
                 if (++i1 == end1) break;
             }
-            if (i1->x1() >= i2->x1()) {
+            if (x1_1 >= x1_2) {
                 if (++i2 == end2) break;
             }
         }
     }
-    return intersection;
+    return out;
+}
+
+// Return the pixels that are in exactly one of the two sequences, keeping
+// only those from the first sequence, the second, or both.  Each input span
+// is consumed from the left as the sweep passes over it: 'c1' and 'c2' are
+// the first columns of *i1 and *i2 that haven't been handled yet.  Pieces
+// from different inputs that touch are joined, so the symmetric difference
+// of two extracted SpanSets is the same as extracting it directly.
+template <typename Iter>
+std::vector<Span> exclusive(
+    Iter i1, Iter const end1,
+    Iter i2, Iter const end2,
+    bool keep_first, bool keep_second
+) {
+    std::vector<Span> result;
+    int last_source = 0;
+    auto emit = [&result, &last_source](int source, int x0, int x1, int y) {
+        if (!result.empty() && last_source != source && result.back().y() == y
+                && result.back().x1() + 1 == x0) {
+            result.back() = Span(Interval(result.back().x0(), x1), y);
+        } else {
+            result.emplace_back(Interval(x0, x1), y);
+        }
+        last_source = source;
+    };
+    int c1 = (i1 != end1) ? i1->x0() : 0;
+    int c2 = (i2 != end2) ? i2->x0() : 0;
+    while (i1 != end1 && i2 != end2) {
+        if (i1->y() < i2->y() || (i1->y() == i2->y() && i1->x1() < c2)) {
+            if (keep_first) emit(1, c1, i1->x1(), i1->y());
+            if (++i1 != end1) c1 = i1->x0();
+        } else if (i2->y() < i1->y() || i2->x1() < c1) {
+            if (keep_second) emit(2, c2, i2->x1(), i2->y());
+            if (++i2 != end2) c2 = i2->x0();
+        } else { // they overlap
+            if (c1 < c2) {
+                if (keep_first) emit(1, c1, c2 - 1, i1->y());
+            } else if (c2 < c1) {
+                if (keep_second) emit(2, c2, c1 - 1, i2->y());
+            }
+            int const x1_1 = i1->x1();
+            int const x1_2 = i2->x1();
+            c1 = c2 = std::min(x1_1, x1_2) + 1;
+            if (x1_1 <= x1_2) {
+                if (++i1 != end1) c1 = i1->x0();
+            }
+            if (x1_1 >= x1_2) {
+                if (++i2 != end2) c2 = i2->x0();
+            }
+        }
+    }
+    if (keep_first) {
+        while (i1 != end1) {
+            emit(1, c1, i1->x1(), i1->y());
+            if (++i1 != end1) c1 = i1->x0();
+        }
+    }
+    if (keep_second) {
+        while (i2 != end2) {
+            emit(2, c2, i2->x1(), i2->y());
+            if (++i2 != end2) c2 = i2->x0();
+        }
+    }
+    return result;
 }
 
 } // anonymous
 
-SpanSet SpanSet::operator|(SpanSet const & other) const {
-    std::vector<Span> together;
-    together.reserve(size() + other.size());
-    std::merge(begin(), end(), other.begin(), other.end(),
-               std::back_inserter(together), SpanAnyLess());
-    std::vector<Span> updated;
-    auto first = together.begin();
-    for (auto first = together.begin(); first != together.end(); ++first) {
-        auto last = std::adjacent_find(
-            first, together.end(),
-            [](Span const & a, Span const & b) {
-                return !a.overlaps(b);
+std::pair<SpanSet::iterator, SpanSet::iterator> SpanSet::row_range(Interval const & rows) const {
+    if (rows.empty()) {
+        return std::make_pair(end(), end());
+    }
+    auto const first = std::lower_bound(
+        begin(), end(), rows.min(),
+        [](Span const & span, int y) { return span.y() < y; }
+    );
+    auto const last = std::upper_bound(
+        first, end(), rows.max(),
+        [](int y, Span const & span) { return y < span.y(); }
+    );
+    return std::make_pair(first, last);
+}
+
+bool SpanSet::contains(int x, int y) const {
+    auto const range = row_range(Interval(y));
+    // The first span in the row that ends at or after x.
+    auto const span = std::lower_bound(
+        range.first, range.second, x,
+        [](Span const & span, int x) { return span.x1() < x; }
+    );
+    return span != range.second && span->x0() <= x;
+}
+
+bool SpanSet::contains(SpanSet const & other) const {
+    auto i1 = begin();
+    for (auto const & span : other) {
+        // Skip spans that end before this one starts; the rest of 'span' must
+        // then be covered by a run of touching spans.
+        while (i1 != end() && (i1->y() < span.y() || (i1->y() == span.y() && i1->x1() < span.x0()))) {
+            ++i1;
+        }
+        std::int64_t next = span.x0();
+        while (next <= span.x1()) {
+            if (i1 == end() || i1->y() != span.y() || i1->x0() > next) {
+                return false;
+            }
+            next = std::int64_t(i1->x1()) + 1;
+            if (next <= span.x1()) {
+                ++i1;
             }
+        }
+    }
+    return true;
+}
+
+void SpanSet::contains(int const * xs, int const * ys, std::size_t n, bool * result) const {
+    detail::OperationTimer timer(Operation::CONTAINS);
+    timer.spans_in(size());
+    timer.pixels(n);
+    bool sorted = true;
+    for (std::size_t i = 1; i < n && sorted; ++i) {
+        sorted = ys[i - 1] < ys[i] || (ys[i - 1] == ys[i] && xs[i - 1] <= xs[i]);
+    }
+    if (sorted) {
+        auto span = begin();
+        for (std::size_t i = 0; i < n; ++i) {
+            while (span != end() && (span->y() < ys[i] || (span->y() == ys[i] && span->x1() < xs[i]))) {
+                ++span;
+            }
+            result[i] = span != end() && span->y() == ys[i] && span->x0() <= xs[i];
+        }
+        return;
+    }
+    // With at least as many points as spans, index the first span of each
+    // row, so only the search within a row is left; that's worthwhile as
+    // long as the index is no bigger than the spans themselves.
+    std::int64_t const y0 = empty() ? 0 : begin()->y();
+    std::int64_t const height = empty() ? 0 : std::int64_t((end() - 1)->y()) - y0 + 1;
+    if (empty() || n < size() || height > std::int64_t(size())) {
+        for (std::size_t i = 0; i < n; ++i) {
+            result[i] = contains(xs[i], ys[i]);
+        }
+        return;
+    }
+    std::vector<std::size_t> rows(height + 1, size());
+    for (std::size_t s = size(); s > 0; --s) {
+        rows[_spans[s - 1].y() - y0] = s - 1;
+    }
+    for (std::int64_t r = height - 1; r >= 0; --r) {
+        rows[r] = std::min(rows[r], rows[r + 1]);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        std::int64_t const r = std::int64_t(ys[i]) - y0;
+        if (r < 0 || r >= height) {
+            result[i] = false;
+            continue;
+        }
+        auto const last = begin() + rows[r + 1];
+        auto const span = std::lower_bound(
+            begin() + rows[r], last, xs[i],
+            [](Span const & span, int x) { return span.x1() < x; }
         );
-        if (last == together.end()) {
-            --last;
+        result[i] = span != last && span->x0() <= xs[i];
+    }
+}
+
+bool SpanSet::overlaps(Box const & box) const {
+    if (box.empty()) {
+        return false;
+    }
+    auto const range = row_range(box.y());
+    for (auto span = range.first; span != range.second; ++span) {
+        if (span->x().overlaps(box.x())) {
+            return true;
         }
-        updated.emplace_back(Interval(first->x0(), last->x1()), first->y());
-        first = last;
     }
-    return SpanSet(updated);
+    return false;
 }
 
-SpanSet SpanSet::operator&(SpanSet const & other) const {
-    return SpanSet(intersect(begin(), end(), other.begin(), other.end()));
+bool SpanSet::overlaps(SpanSet const & other) const {
+    if (empty() || other.empty()) {
+        return false;
+    }
+    auto const rows = Interval(begin()->y(), (end() - 1)->y()) &
+        Interval(other.begin()->y(), (other.end() - 1)->y());
+    auto const range1 = row_range(rows);
+    auto const range2 = other.row_range(rows);
+    auto i1 = range1.first;
+    auto i2 = range2.first;
+    auto strictly_less = SpanStrictLess();
+    while (i1 != range1.second && i2 != range2.second) {
+        if (strictly_less(*i1, *i2)) {
+            ++i1;
+        } else if (strictly_less(*i2, *i1)) {
+            ++i2;
+        } else {
+            return true;
+        }
+    }
+    return false;
 }
 
-SpanSet & SpanSet::operator|=(SpanSet const & other) {
-    return *this = *this | other;
+SpanSet SpanSet::operator|(SpanSet const & other) const {
+    detail::OperationTimer timer(Operation::UNION);
+    timer.spans_in(size() + other.size());
+    std::vector<Span> spans(size() + other.size());
+    spans.erase(unite(begin(), end(), other.begin(), other.end(), spans.begin()), spans.end());
+    timer.output(spans);
+    return SpanSet(std::move(spans));
 }
 
-SpanSet & SpanSet::operator&=(SpanSet const & other) {
-    return *this = *this & other;
+SpanSet SpanSet::operator&(SpanSet const & other) const {
+    detail::OperationTimer timer(Operation::INTERSECTION);
+    timer.spans_in(size() + other.size());
+    std::vector<Span> spans(size() + other.size());
+    spans.erase(intersect(begin(), end(), other.begin(), other.end(), spans.begin()), spans.end());
+    timer.output(spans);
+    return SpanSet(std::move(spans));
 }
 
-bool SpanSet::operator==(SpanSet const & other) const {
-    return std::equal(begin(), end(), other.begin(), other.end());
+SpanSet SpanSet::operator-(SpanSet const & other) const {
+    detail::OperationTimer timer(Operation::DIFFERENCE);
+    timer.spans_in(size() + other.size());
+    std::vector<Span> spans = exclusive(begin(), end(), other.begin(), other.end(), true, false);
+    timer.output(spans);
+    return SpanSet(std::move(spans));
 }
 
-template <typename T>
-SpanSet SpanSet::extract(ImageWrapper<T const> const & image, T value) {
-    std::vector<Span> spans;
-    if (image.bbox.empty()) {
-        return SpanSet(spans);
-    }
-    T const * py = image.ptr;
-    for (int y = image.bbox.y0(); y <= image.bbox.y1(); ++y) {
-        T const * p = py;
-        int x = image.bbox.x0();
-        while (x <= image.bbox.x1()) {
-            if (*p == value) {
-                int x0 = x;
-                while (true) {
-                    ++x;
-                    ++p;
-                    if (x > image.bbox.x1() || *p != value) {
-                        spans.emplace_back(Interval(x0, x - 1), y);
-                        break;
-                    }
-                }
-            }
-            ++x;
-            ++p;
-        }
-        py += image.stride;
-    }
-    return SpanSet(spans);
+SpanSet SpanSet::operator^(SpanSet const & other) const {
+    detail::OperationTimer timer(Operation::SYMMETRIC_DIFFERENCE);
+    timer.spans_in(size() + other.size());
+    std::vector<Span> spans = exclusive(begin(), end(), other.begin(), other.end(), true, true);
+    timer.output(spans);
+    return SpanSet(std::move(spans));
 }
 
-template <typename T>
-void SpanSet::insert(ImageWrapper<T> const & image, T value) const {
-    for (auto const & span : *this) {
-        if (!image.bbox.y().overlaps(span.y())) {
-            continue;
-        }
-        Interval x_intersection = span.x() & image.bbox.x();
-        if (x_intersection.empty()) {
-            continue;
-        }
-        T * p = image.ptr + image.stride*(span.y() - image.bbox.y0());
-        T * first = p + x_intersection.min() - image.bbox.x0();
-        T * last = first + x_intersection.length();
-        std::transform(first, last, first, [value](T z) { return z + value; });
+// The in-place forms move this SpanSet's spans to the back of its own
+// storage and merge forward into the front, so they only allocate when the
+// vector's capacity is less than the two sizes together.  They're counted
+// as UNION and INTERSECTION, with bytes only when they do reallocate; -= and
+// ^= are counted by the binary operators they call.
+
+namespace {
+
+// Report the result of an in-place operation on 'spans', whose capacity was
+// 'old_capacity' before it started.
+void record_in_place(detail::OperationTimer & timer, std::vector<Span> const & spans,
+                     std::size_t old_capacity) {
+    timer.spans_out(spans.size());
+    if (spans.capacity() != old_capacity) {
+        timer.bytes(spans.capacity()*sizeof(Span));
     }
 }
 
-class LabeledSpansByRow {
-public:
+} // anonymous
 
-    static constexpr int const NOT_LABELED = 0;
-    static constexpr int const FIRST_LABEL = 1;
+SpanSet & SpanSet::operator|=(SpanSet const & other) {
+    detail::OperationTimer timer(Operation::UNION);
+    timer.spans_in(size() + other.size());
+    if (&other == this || other.empty()) {
+        timer.spans_out(size());
+        return *this;
+    }
+    std::size_t const capacity = _spans.capacity();
+    std::size_t const n = _spans.size();
+    _spans.resize(n + other.size());
+    auto const first = std::move_backward(_spans.begin(), _spans.begin() + n, _spans.end());
+    _spans.erase(unite(first, _spans.end(), other.begin(), other.end(), _spans.begin()),
+                 _spans.end());
+    record_in_place(timer, _spans, capacity);
+    return *this;
+}
 
-    // A range of SpanSet iterators.
-    class Range {
-    public:
+SpanSet & SpanSet::operator&=(SpanSet const & other) {
+    detail::OperationTimer timer(Operation::INTERSECTION);
+    timer.spans_in(size() + other.size());
+    if (&other == this) {
+        timer.spans_out(size());
+        return *this;
+    }
+    if (empty() || other.empty()) {
+        _spans.clear();
+        return *this;
+    }
+    std::size_t const capacity = _spans.capacity();
+    std::size_t const n = _spans.size();
+    _spans.resize(n + other.size());
+    auto const first = std::move_backward(_spans.begin(), _spans.begin() + n, _spans.end());
+    _spans.erase(intersect(first, _spans.end(), other.begin(), other.end(), _spans.begin()),
+                 _spans.end());
+    record_in_place(timer, _spans, capacity);
+    return *this;
+}
 
-        using iterator = SpanSet::iterator;
+SpanSet & SpanSet::operator-=(SpanSet const & other) {
+    return *this = *this - other;
+}
 
-        explicit Range(iterator first) : _first(first), _count(1) {}
+SpanSet & SpanSet::operator^=(SpanSet const & other) {
+    return *this = *this ^ other;
+}
 
-        iterator begin() const { return _first; }
-        iterator end() const { return _first + _count; }
+bool SpanSet::operator==(SpanSet const & other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+}
 
-        void expand() { ++_count; }
+namespace {
 
-    private:
-        iterator _first;
-        std::size_t _count;
+// Merge the spans of sets[first, last) with a binary min-heap holding each
+// set's next span, coalescing overlapping spans the same way unite() does.
+// The heap is hand-rolled so the common step (consume the smallest span and
+// replace it with its successor) is a single sift-down.
+std::vector<Span> unite_sets(
+    std::vector<SpanSet const *> const & sets, std::size_t first, std::size_t last
+) {
+    struct Cursor {
+        Span head;
+        SpanSet::iterator next;
+        SpanSet::iterator end;
     };
-
-    LabeledSpansByRow(Range::iterator first, Range::iterator const last) :
-        _first(first),
-        _map(),
-        _labels(last - first, NOT_LABELED)
-    {
-        auto row = _map.begin();
-        for (auto iter = first; iter != last; ++iter) {
-            if (row != _map.end() && row->first == iter->y()) {
-                row->second.expand();
-            } else {
-                row = _map.emplace_hint(_map.end(), iter->y(), Range(iter));
+    std::vector<Cursor> heap;
+    heap.reserve(last - first);
+    std::size_t total = 0;
+    for (std::size_t i = first; i < last; ++i) {
+        if (!sets[i]->empty()) {
+            heap.push_back(Cursor{*sets[i]->begin(), sets[i]->begin() + 1, sets[i]->end()});
+            total += sets[i]->size();
+        }
+    }
+    auto any_less = SpanAnyLess();
+    auto sift_down = [&heap, &any_less](std::size_t i) {
+        std::size_t const n = heap.size();
+        Cursor moving = heap[i];
+        while (true) {
+            std::size_t child = 2*i + 1;
+            if (child >= n) break;
+            if (child + 1 < n && any_less(heap[child + 1].head, heap[child].head)) {
+                ++child;
             }
+            if (!any_less(heap[child].head, moving.head)) break;
+            heap[i] = heap[child];
+            i = child;
         }
+        heap[i] = moving;
+    };
+    for (std::size_t i = heap.size()/2; i > 0; --i) {
+        sift_down(i - 1);
     }
-
-    std::pair<Range const *, Range const *> neighboring_rows(int y) const {
-        auto found = _map.find(y);
-        std::pair<Range const *, Range const *> result(nullptr, nullptr);
-        if (found != _map.begin()) {
-            auto previous = found;
-            --previous;
-            result.first = &previous->second;
+    std::vector<Span> result;
+    result.reserve(total);
+    while (!heap.empty()) {
+        Cursor & top = heap.front();
+        Span const & span = top.head;
+        if (!result.empty() && result.back().overlaps(span)) {
+            if (span.x1() > result.back().x1()) {
+                result.back() = Span(Interval(result.back().x0(), span.x1()), span.y());
+            }
+        } else {
+            result.push_back(span);
         }
-        auto next = found;
-        if (++next != _map.end()) {
-            result.second = &next->second;
+        if (top.next != top.end) {
+            top.head = *top.next++;
+        } else {
+            top = heap.back();
+            heap.pop_back();
+            if (heap.empty()) break;
         }
-        return result;
+        sift_down(0);
     }
+    return result;
+}
 
-    int & get_label(Range::iterator iter) { return _labels[iter - _first]; }
+} // anonymous
 
-private:
-    Range::iterator _first;
-    std::map<int, Range> _map;
-    std::vector<int> _labels;
-};
+SpanSet SpanSet::union_all(std::vector<SpanSet> const & sets, int threads) {
+    std::vector<SpanSet const *> pointers;
+    pointers.reserve(sets.size());
+    for (auto const & set : sets) {
+        pointers.push_back(&set);
+    }
+    return union_all(pointers, threads);
+}
+
+SpanSet SpanSet::union_all(std::vector<SpanSet const *> const & sets, int threads) {
+    for (auto set : sets) {
+        if (!set) {
+            throw std::invalid_argument("union_all inputs may not be null");
+        }
+    }
+    detail::OperationTimer timer(Operation::UNION_ALL);
+    for (auto set : sets) {
+        timer.spans_in(set->size());
+    }
+    threads = detail::resolve_threads(threads);
+    std::vector<std::size_t> groups = detail::even_chunks(sets.size(), threads);
+    if (groups.size() <= 2) {
+        std::vector<Span> spans = unite_sets(sets, 0, sets.size());
+        timer.output(spans);
+        return SpanSet(std::move(spans));
+    }
+    std::vector<SpanSet> partial(groups.size() - 1);
+    detail::parallel_for(partial.size(), threads, [&](std::size_t g) {
+        partial[g]._spans = unite_sets(sets, groups[g], groups[g + 1]);
+    });
+    // Combine neighbouring partial unions in rounds, halving their number
+    // each time.
+    for (std::size_t step = 1; step < partial.size(); step *= 2) {
+        std::size_t const pairs = (partial.size() + 2*step - 1)/(2*step);
+        detail::parallel_for(pairs, threads, [&](std::size_t p) {
+            std::size_t const i = 2*step*p;
+            if (i + step < partial.size()) {
+                partial[i] |= partial[i + step];
+                partial[i + step] = SpanSet();
+            }
+        });
+    }
+    timer.output(partial.front()._spans);
+    return std::move(partial.front());
+}
 
 
-int const LabeledSpansByRow::NOT_LABELED;
-int const LabeledSpansByRow::FIRST_LABEL;
+namespace {
 
+// Index of the first span after 'first' that is not in the same row.
+std::size_t end_of_row(std::vector<Span> const & spans, std::size_t first) {
+    std::size_t last = first + 1;
+    while (last < spans.size() && spans[last].y() == spans[first].y()) {
+        ++last;
+    }
+    return last;
+}
 
-void label_adjacent(
-    SpanSet::iterator span,
-    LabeledSpansByRow & by_row,
-    int current_label
+// Unite the spans in [first, last) that are connected through pixels in the
+// same row or in the row immediately above.  [prev_first, first) must be the
+// previous row's spans, which may not actually be adjacent.
+void label_row(
+    std::vector<Span> const & spans,
+    std::size_t prev_first, std::size_t first, std::size_t last,
+    Connectivity connectivity,
+    detail::UnionFind & sets
 ) {
-    auto process_row = [span, &by_row, current_label](
-        LabeledSpansByRow::Range const * range
-    ) {
-        if (range == nullptr) return;
-        for (auto i = range->begin(); i != range->end(); ++i) {
-            int & label_i = by_row.get_label(i);
-            if (label_i == 0 && i->x().overlaps(span->x())) {
-                label_i = current_label;
-                label_adjacent(i, by_row, current_label);
-            }
+    detail::SpanRuns const runs(spans);
+    detail::unite_within_row(runs, first, last, sets);
+    if (prev_first != first && spans[prev_first].y() + 1 == spans[first].y()) {
+        detail::unite_adjacent_rows(runs, prev_first, first, first, last, connectivity, sets);
+    }
+}
+
+// Label all rows in [first, last), which must start at a row boundary.
+void label_rows(
+    std::vector<Span> const & spans,
+    std::size_t first, std::size_t const last,
+    Connectivity connectivity,
+    detail::UnionFind & sets
+) {
+    std::size_t prev_first = first;
+    while (first < last) {
+        std::size_t row_last = end_of_row(spans, first);
+        label_row(spans, prev_first, first, row_last, connectivity, sets);
+        prev_first = first;
+        first = row_last;
+    }
+}
+
+} // anonymous
+
+SpanSetCollection SpanSet::split_collection(Connectivity connectivity, int threads) const {
+    detail::OperationTimer timer(Operation::SPLIT);
+    timer.spans_in(size());
+    threads = detail::resolve_threads(threads);
+    detail::UnionFind sets(size());
+    // Bands of rows only touch their own part of the union-find, so they can
+    // be labeled concurrently; the rows on either side of each seam between
+    // bands are then joined serially.
+    std::vector<std::size_t> bands = detail::row_bands(_spans, 0, size(), threads);
+    detail::parallel_for(bands.size() - 1, threads, [&](std::size_t b) {
+        label_rows(_spans, bands[b], bands[b + 1], connectivity, sets);
+    });
+    for (std::size_t b = 1; b + 1 < bands.size(); ++b) {
+        std::size_t const first = bands[b];
+        std::size_t prev_first = first - 1;
+        while (prev_first > 0 && _spans[prev_first - 1].y() == _spans[first - 1].y()) {
+            --prev_first;
         }
-    };
-    auto neighbors = by_row.neighboring_rows(span->y());
-    process_row(neighbors.first);  // previous row
-    process_row(neighbors.second); // next row
-}
-
-std::vector<SpanSet> SpanSet::split() const {
-    LabeledSpansByRow by_row(begin(), end());
-    int current_label = LabeledSpansByRow::FIRST_LABEL;
-    for (auto i = begin(); i != end(); ++i) {
-        int & label = by_row.get_label(i);
-        if (label == LabeledSpansByRow::NOT_LABELED) {
-            label = current_label;
-            label_adjacent(i, by_row, current_label);
-            ++current_label;
+        label_row(_spans, prev_first, first, end_of_row(_spans, first), connectivity, sets);
+    }
+    std::vector<std::size_t> roots(size());
+    std::vector<std::size_t> chunks = detail::even_chunks(size(), threads);
+    detail::parallel_for(chunks.size() - 1, threads, [&](std::size_t c) {
+        for (std::size_t i = chunks[c]; i < chunks[c + 1]; ++i) {
+            roots[i] = sets.root(i);
         }
+    });
+    // Numbering the components in the order of their first span is what
+    // makes the result independent of the number of threads.
+    std::size_t const n = detail::number_components(roots);
+    SpanSetCollection result = group_components(_spans, roots, n);
+    timer.output(result.spans());
+    return result;
+}
+
+std::vector<SpanSet> SpanSet::split(Connectivity connectivity, int threads) const {
+    return split_collection(connectivity, threads).to_span_sets(threads);
+}
+
+SpanSetCollection SpanSet::group_components(
+    std::vector<Span> const & spans, std::vector<std::size_t> const & component,
+    std::size_t n_components
+) {
+    // Counting sort of the spans by component, which keeps them in order
+    // within each.
+    std::vector<std::size_t> offsets(n_components + 1, 0);
+    for (auto c : component) {
+        ++offsets[c + 1];
     }
-    // Vector-of-vectors-of-Span, one inner vector for each label.
-    std::vector<std::vector<Span>> groups(current_label - 1);
-    for (auto i = begin(); i != end(); ++i) {
-        groups[by_row.get_label(i) - 1].push_back(*i);
+    for (std::size_t n = 1; n < offsets.size(); ++n) {
+        offsets[n] += offsets[n - 1];
     }
-    std::vector<SpanSet> result;
-    result.reserve(groups.size());
-    for (auto & spans : groups) {
-        result.push_back(SpanSet(std::move(spans)));
+    std::vector<Span> sorted(spans.size());
+    std::vector<std::size_t> cursors(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < spans.size(); ++i) {
+        sorted[cursors[component[i]]++] = spans[i];
     }
-    return result;
-};
+    return SpanSetCollection(std::move(sorted), std::move(offsets));
+}
 
 
 #define INSTANTIATE(T)                                                  \
-    template SpanSet SpanSet::extract(ImageWrapper<T const> const &, T); \
-    template void SpanSet::insert(ImageWrapper<T> const &, T) const
+    template SpanSet SpanSet::extract(ImageWrapper<T const> const &, T, int); \
+    template SpanSet SpanSet::extract_if(ImageWrapper<T const> const &, Equal<T> const &, int); \
+    template std::vector<SpanSet> SpanSet::extract_components(          \
+        ImageWrapper<T const> const &, T, Connectivity, ImageWrapper<std::int32_t> const *); \
+    template std::vector<SpanSet> SpanSet::extract_components_if(       \
+        ImageWrapper<T const> const &, Equal<T> const &, Connectivity, ImageWrapper<std::int32_t> const *); \
+    template void SpanSet::insert(ImageWrapper<T> const &, T, InsertMode, int) const
+
+#define INSTANTIATE_PREDICATE(T, Pred) \
+    template SpanSet SpanSet::extract_if(ImageWrapper<T const> const &, Pred<T> const &, int); \
+    template std::vector<SpanSet> SpanSet::extract_components_if(       \
+        ImageWrapper<T const> const &, Pred<T> const &, Connectivity, ImageWrapper<std::int32_t> const *)
+
+#define INSTANTIATE_COMPARISONS(T)              \
+    INSTANTIATE_PREDICATE(T, Greater);          \
+    INSTANTIATE_PREDICATE(T, GreaterEqual);     \
+    INSTANTIATE_PREDICATE(T, Less);             \
+    INSTANTIATE_PREDICATE(T, LessEqual);        \
+    INSTANTIATE_PREDICATE(T, InRange)
+
+#define INSTANTIATE_LABELS(T)                                           \
+    template std::map<T, SpanSet> SpanSet::extract_labels(ImageWrapper<T const> const &); \
+    template std::map<T, SpanSet> SpanSet::extract_labels(ImageWrapper<T const> const &, T)
+
+#define INSTANTIATE_BITS(T)                     \
+    INSTANTIATE_PREDICATE(T, AnyBits);          \
+    INSTANTIATE_PREDICATE(T, AllBits)
 
 INSTANTIATE(bool);
 INSTANTIATE(std::uint8_t);
@@ -448,4 +849,29 @@ INSTANTIATE(std::int64_t);
 INSTANTIATE(float);
 INSTANTIATE(double);
 
+INSTANTIATE_COMPARISONS(std::uint8_t);
+INSTANTIATE_COMPARISONS(std::int8_t);
+INSTANTIATE_COMPARISONS(std::uint16_t);
+INSTANTIATE_COMPARISONS(std::int16_t);
+INSTANTIATE_COMPARISONS(std::uint32_t);
+INSTANTIATE_COMPARISONS(std::int32_t);
+INSTANTIATE_COMPARISONS(std::uint64_t);
+INSTANTIATE_COMPARISONS(std::int64_t);
+INSTANTIATE_COMPARISONS(float);
+INSTANTIATE_COMPARISONS(double);
+
+INSTANTIATE_LABELS(std::uint8_t);
+INSTANTIATE_LABELS(std::int8_t);
+INSTANTIATE_LABELS(std::uint16_t);
+INSTANTIATE_LABELS(std::int16_t);
+INSTANTIATE_LABELS(std::uint32_t);
+INSTANTIATE_LABELS(std::int32_t);
+INSTANTIATE_LABELS(std::uint64_t);
+INSTANTIATE_LABELS(std::int64_t);
+
+INSTANTIATE_BITS(std::uint8_t);
+INSTANTIATE_BITS(std::uint16_t);
+INSTANTIATE_BITS(std::uint32_t);
+INSTANTIATE_BITS(std::uint64_t);
+
 } // namespace spanops
@@ -1,7 +1,12 @@
 #ifndef SPANOPS_H_INCLUDED
 #define SPANOPS_H_INCLUDED
 
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 namespace spanops {
@@ -127,6 +132,19 @@ private:
 };
 
 
+// Pixel connectivity used to decide which spans belong to the same connected
+// component: FOUR joins pixels that share an edge, EIGHT also joins pixels
+// that only share a corner.
+enum class Connectivity { FOUR = 4, EIGHT = 8 };
+
+
+// How SpanSet::insert combines its value with the pixels a SpanSet covers:
+// ADD adds it, ASSIGN overwrites them, OR combines them bitwise (integer
+// images only), and MAX keeps the larger of the two.  For bool images, ADD
+// and MAX are the same as OR.
+enum class InsertMode { ADD, ASSIGN, OR, MAX };
+
+
 template <typename T>
 struct ImageWrapper {
     T * ptr;
@@ -135,6 +153,92 @@ struct ImageWrapper {
 };
 
 
+// Statistics of the pixels of an image covered by a SpanSet (see
+// SpanSet::reduce).  The moments are weighted by pixel value: (x, y) is the
+// centroid and xx, xy, yy are the second moments about it.  min and max are
+// NaN if no pixels are covered, and the moments are NaN if the pixels sum to
+// zero.
+struct PixelStats {
+    std::size_t count;
+    double sum;
+    double min;
+    double max;
+    double x;
+    double y;
+    double xx;
+    double xy;
+    double yy;
+
+    double mean() const { return sum/static_cast<double>(count); }
+};
+
+
+// Pixel predicates for SpanSet::extract_if.  Equal and the comparisons are
+// available for all pixel types but bool (which only supports Equal), and the
+// bit tests for the unsigned integer types.  Code that includes kernels.h can
+// use extract_if (and the other image operations) with any predicate and
+// pixel type.
+
+template <typename T>
+struct Equal {
+    T value;
+    bool operator()(T x) const { return x == value; }
+};
+
+template <typename T>
+struct Greater {
+    T threshold;
+    bool operator()(T x) const { return x > threshold; }
+};
+
+template <typename T>
+struct GreaterEqual {
+    T threshold;
+    bool operator()(T x) const { return x >= threshold; }
+};
+
+template <typename T>
+struct Less {
+    T threshold;
+    bool operator()(T x) const { return x < threshold; }
+};
+
+template <typename T>
+struct LessEqual {
+    T threshold;
+    bool operator()(T x) const { return x <= threshold; }
+};
+
+// Closed range: min <= x <= max.
+template <typename T>
+struct InRange {
+    T min;
+    T max;
+    bool operator()(T x) const { return min <= x && x <= max; }
+};
+
+template <typename T>
+struct AnyBits {
+    T bits;
+    bool operator()(T x) const { return (x & bits) != 0; }
+};
+
+template <typename T>
+struct AllBits {
+    T bits;
+    bool operator()(T x) const { return (x & bits) == bits; }
+};
+
+
+class SpanSetCollection;
+
+// A set of pixels, stored as Spans sorted by (y, x0) that do not overlap.
+//
+// All const member functions may be called concurrently on the same SpanSet
+// (insert only writes to the image it is given, and concurrent inserts into
+// the same image need external synchronization); the compound assignment
+// operators need exclusive access.  The Python bindings release the GIL
+// around everything that scans images or spans, with the same contract.
 class SpanSet {
 public:
 
@@ -142,6 +246,10 @@ public:
 
     explicit SpanSet(Box const & box);
 
+    // Construct from spans that are already sorted by (y, x0), non-empty, and
+    // non-overlapping; throws std::invalid_argument if they aren't.
+    static SpanSet from_spans(std::vector<Span> spans);
+
     int area() const;
     Box bbox() const;
 
@@ -153,31 +261,450 @@ public:
     bool empty() const { return _spans.empty(); }
     std::size_t size() const { return _spans.size(); }
 
+    // Return the spans whose rows are in 'rows', found by binary search.
+    std::pair<iterator, iterator> row_range(Interval const & rows) const;
+
     SpanSet operator|(SpanSet const & other) const;
     SpanSet operator&(SpanSet const & other) const;
+    SpanSet operator-(SpanSet const & other) const;
+    SpanSet operator^(SpanSet const & other) const;
 
     SpanSet & operator|=(SpanSet const & other);
     SpanSet & operator&=(SpanSet const & other);
+    SpanSet & operator-=(SpanSet const & other);
+    SpanSet & operator^=(SpanSet const & other);
 
     bool operator==(SpanSet const & other) const;
     bool operator!=(SpanSet const & other) const { return !(*this == other); }
 
+    // Exact tests against the pixels in this SpanSet, using binary searches
+    // to skip rows that can't match.  contains(other), which is true if every
+    // pixel in 'other' is in this SpanSet, is instead a single merge pass.
+    bool contains(int x, int y) const;
+    bool contains(SpanSet const & other) const;
+    bool overlaps(Box const & box) const;
+    bool overlaps(SpanSet const & other) const;
+
+    // Set result[i] = contains(xs[i], ys[i]) for n points.  Points sorted by
+    // y and then x (as they are when read off an image) are matched in one
+    // merge pass over the spans; otherwise each point is a binary search.
+    void contains(int const * xs, int const * ys, std::size_t n, bool * result) const;
+
+    // Morphological dilation and erosion by a structuring element centered on
+    // (0, 0).  dilated returns the Minkowski sum, i.e. the points p + k for
+    // every p in this SpanSet and k in 'kernel'; eroded returns the points p
+    // for which p + k is in this SpanSet for every k in 'kernel', and throws
+    // std::invalid_argument if the kernel is empty.  Both work row by row on
+    // the spans, without rasterizing, and merge touching spans in the result.
+    SpanSet dilated(SpanSet const & kernel) const;
+    SpanSet eroded(SpanSet const & kernel) const;
+
+    // Return the pixels within 'radius' of (0, 0), for use as a kernel; a box
+    // kernel is just SpanSet(Box(...)).
+    static SpanSet circle(int radius);
+
+    // Return the union of any number of SpanSets, merging all of them at once
+    // instead of one at a time.  With threads > 1 (or < 1, for one per core)
+    // groups of the inputs are merged in parallel and the partial unions are
+    // then combined pairwise, also in parallel.  The pointer form avoids
+    // copying the inputs; none of the pointers may be null.
+    static SpanSet union_all(std::vector<SpanSet> const & sets, int threads = 1);
+    static SpanSet union_all(std::vector<SpanSet const *> const & sets, int threads = 1);
+
+    // Encode in the compact binary format described in serialize.cc, and
+    // decode it again; from_bytes throws std::invalid_argument if the data is
+    // malformed.
+    std::vector<std::uint8_t> to_bytes() const;
+    static SpanSet from_bytes(std::uint8_t const * data, std::size_t size);
+
+    // Combine 'value' with the pixels of 'image' this SpanSet covers.  With
+    // threads > 1 (or < 1, for one per core) bands of rows are written in
+    // parallel.  Throws std::invalid_argument for InsertMode::OR with a
+    // floating-point image.
     template <typename T>
-    void insert(ImageWrapper<T> const & image, T value) const;
+    void insert(ImageWrapper<T> const & image, T value, InsertMode mode = InsertMode::ADD,
+                int threads = 1) const;
 
+    // Compute statistics of the pixels of 'image' this SpanSet covers,
+    // ignoring any of its pixels that lie outside the image.
     template <typename T>
-    static SpanSet extract(ImageWrapper<T const> const & image, T value);
+    PixelStats reduce(ImageWrapper<T const> const & image) const;
 
-    std::vector<SpanSet> split() const;
+    // Call reduce for each of many SpanSets over the same image, with threads
+    // as for split.  None of the pointers may be null.
+    template <typename T>
+    static std::vector<PixelStats> reduce_all(
+        std::vector<SpanSet const *> const & sets, ImageWrapper<T const> const & image,
+        int threads = 1
+    );
+
+    // Return the pixels of 'image' equal to 'value', or satisfying 'pred'.
+    // With threads > 1 (or < 1, for one per core) bands of rows are scanned
+    // in parallel.
+    template <typename T>
+    static SpanSet extract(ImageWrapper<T const> const & image, T value, int threads = 1);
+
+    template <typename T, typename Pred>
+    static SpanSet extract_if(ImageWrapper<T const> const & image, Pred const & pred,
+                              int threads = 1);
+
+    // Extract a SpanSet for every distinct pixel value in a single pass over
+    // the image, optionally skipping a background value.  Only available for
+    // integer pixel types.
+    template <typename T>
+    static std::map<T, SpanSet> extract_labels(ImageWrapper<T const> const & image);
+
+    template <typename T>
+    static std::map<T, SpanSet> extract_labels(ImageWrapper<T const> const & image, T background);
+
+    // Split into connected components, ordered by their first span.  With
+    // threads > 1 (or < 1, for one per core) bands of rows are labeled in
+    // parallel; the result does not depend on the number of threads.
+    std::vector<SpanSet> split(Connectivity connectivity = Connectivity::FOUR, int threads = 1) const;
+
+    // Like split, but return the components in a single SpanSetCollection,
+    // instead of allocating each one separately.
+    SpanSetCollection split_collection(Connectivity connectivity = Connectivity::FOUR,
+                                       int threads = 1) const;
+
+    // Equivalent to extract(image, value).split(connectivity) (or the same
+    // with extract_if), but done as the image is scanned: each row's runs are
+    // joined to the runs they touch in the row above as soon as they're
+    // found.  If 'labels' is not null, it must have the same bbox as 'image',
+    // and each of its pixels is set to one plus the index of the component
+    // that pixel is in, or zero if it's in none.
+    template <typename T>
+    static std::vector<SpanSet> extract_components(
+        ImageWrapper<T const> const & image, T value,
+        Connectivity connectivity = Connectivity::FOUR,
+        ImageWrapper<std::int32_t> const * labels = nullptr
+    );
+
+    template <typename T, typename Pred>
+    static std::vector<SpanSet> extract_components_if(
+        ImageWrapper<T const> const & image, Pred const & pred,
+        Connectivity connectivity = Connectivity::FOUR,
+        ImageWrapper<std::int32_t> const * labels = nullptr
+    );
 
 private:
 
     explicit SpanSet(std::vector<Span> const & spans) : _spans(spans) {}
 
+    explicit SpanSet(std::vector<Span> && spans) : _spans(std::move(spans)) {}
+
+    friend class SpanSetCollection;
+
+    // Group 'spans' by component, where component[i] is the component of
+    // spans[i]; spans stay in order within each.
+    static SpanSetCollection group_components(
+        std::vector<Span> const & spans, std::vector<std::size_t> const & component,
+        std::size_t n_components
+    );
+
+    template <typename T>
+    static std::map<T, SpanSet> extract_labels_impl(
+        ImageWrapper<T const> const & image, bool skip_background, T background
+    );
+
     std::vector<Span> _spans;
 };
 
 
+// A deferred combination of SpanSets with |, &, - and ^, e.g.
+//
+//     SpanSet mask = (((SpanSetExpression(a) | b) & c) - d).evaluate();
+//
+// At least one operand of each operator must already be an expression;
+// otherwise the eager SpanSet operator is used.  Nothing is computed until
+// evaluate, which sweeps the rows of all of the operands at once instead of
+// building a temporary SpanSet for each operator.
+// The result covers the same pixels as the eager operators would, with
+// touching spans joined.  Expressions refer to their SpanSets, which must
+// outlive them; a SpanSet that appears more than once is only swept once.
+class SpanSetExpression {
+public:
+
+    // Implicit, so SpanSets can be used directly as operands.
+    SpanSetExpression(SpanSet const & operand);
+
+    SpanSet evaluate() const;
+
+    friend SpanSetExpression operator|(SpanSetExpression const & a, SpanSetExpression const & b);
+    friend SpanSetExpression operator&(SpanSetExpression const & a, SpanSetExpression const & b);
+    friend SpanSetExpression operator-(SpanSetExpression const & a, SpanSetExpression const & b);
+    friend SpanSetExpression operator^(SpanSetExpression const & a, SpanSetExpression const & b);
+
+private:
+
+    enum class Op { OPERAND, UNION, INTERSECTION, DIFFERENCE, SYMMETRIC_DIFFERENCE };
+
+    struct Node;
+
+    SpanSetExpression(Op op, SpanSetExpression const & a, SpanSetExpression const & b);
+
+    std::shared_ptr<Node const> _node;
+};
+
+SpanSetExpression operator|(SpanSetExpression const & a, SpanSetExpression const & b);
+SpanSetExpression operator&(SpanSetExpression const & a, SpanSetExpression const & b);
+SpanSetExpression operator-(SpanSetExpression const & a, SpanSetExpression const & b);
+SpanSetExpression operator^(SpanSetExpression const & a, SpanSetExpression const & b);
+
+
+// An alternative, row-indexed layout for a SpanSet.
+//
+// The spans of row y are the pairs (x0s[i], x1s[i]) for i in
+// [offsets[y - y0], offsets[y - y0 + 1]), so storage is 8 bytes per span plus
+// 4 per row (instead of 12 per span), and a row's spans are found in constant
+// time.  Rows without spans between the first and last row are allowed.
+class CompactSpanSet {
+public:
+
+    CompactSpanSet() : _y0(0), _offsets(1, 0u), _x0(), _x1() {}
+
+    explicit CompactSpanSet(SpanSet const & spans);
+
+    SpanSet to_span_set() const;
+
+    int area() const;
+    Box bbox() const;
+
+    bool empty() const { return _x0.empty(); }
+    std::size_t size() const { return _x0.size(); }
+
+    // Rows from the first span to the last (empty if there are no spans).
+    Interval rows() const { return Interval(_y0, _y0 + static_cast<int>(_offsets.size()) - 2); }
+
+    // Number of spans in row y, and pointers to their x0 and x1 values.
+    std::size_t row_size(int y) const;
+    int const * row_x0(int y) const { return _x0.data() + row_begin(y); }
+    int const * row_x1(int y) const { return _x1.data() + row_begin(y); }
+
+    CompactSpanSet operator&(CompactSpanSet const & other) const;
+
+    bool operator==(CompactSpanSet const & other) const;
+    bool operator!=(CompactSpanSet const & other) const { return !(*this == other); }
+
+    // Same as SpanSet::insert; bands of rows are written in parallel.
+    template <typename T>
+    void insert(ImageWrapper<T> const & image, T value, InsertMode mode = InsertMode::ADD,
+                int threads = 1) const;
+
+    std::vector<CompactSpanSet> split(Connectivity connectivity = Connectivity::FOUR) const;
+
+private:
+
+    std::size_t row_begin(int y) const;
+
+    // Add a span at the end; y may not be less than the last row.
+    void append(int y, int x0, int x1);
+
+    // Remove empty rows at the end.
+    void trim();
+
+    int _y0;
+    std::vector<std::uint32_t> _offsets;
+    std::vector<int> _x0;
+    std::vector<int> _x1;
+};
+
+
+// Many SpanSets (such as the components from SpanSet::split_collection)
+// stored back to back in one buffer: SpanSet i is the spans in
+// [offsets()[i], offsets()[i + 1]).  A collection takes two allocations, not
+// one per SpanSet, and its SpanSets are contiguous in memory.
+class SpanSetCollection {
+public:
+
+    // A read-only view of one SpanSet in a collection, valid as long as the
+    // collection is.
+    class View {
+    public:
+
+        using iterator = SpanSet::iterator;
+
+        iterator begin() const { return _begin; }
+        iterator end() const { return _end; }
+
+        bool empty() const { return _begin == _end; }
+        std::size_t size() const { return _end - _begin; }
+
+        int area() const;
+        Box bbox() const;
+
+        SpanSet to_span_set() const;
+
+    private:
+        friend class SpanSetCollection;
+
+        View(iterator begin, iterator end) : _begin(begin), _end(end) {}
+
+        iterator _begin;
+        iterator _end;
+    };
+
+    SpanSetCollection() : _spans(), _offsets(1, 0u) {}
+
+    std::size_t size() const { return _offsets.size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    View operator[](std::size_t i) const {
+        return View(_spans.begin() + _offsets[i], _spans.begin() + _offsets[i + 1]);
+    }
+
+    std::vector<Span> const & spans() const { return _spans; }
+    std::vector<std::size_t> const & offsets() const { return _offsets; }
+
+    // Copy into separate SpanSets, with threads as for SpanSet::split.
+    std::vector<SpanSet> to_span_sets(int threads = 1) const;
+
+private:
+    friend class SpanSet;
+
+    SpanSetCollection(std::vector<Span> spans, std::vector<std::size_t> offsets) :
+        _spans(std::move(spans)), _offsets(std::move(offsets))
+    {}
+
+    std::vector<Span> _spans;
+    std::vector<std::size_t> _offsets;
+};
+
+
+// A static spatial index over a collection of SpanSets, for finding the ones
+// that overlap a Box, a point, or each other.
+//
+// The SpanSets' bounding boxes are bulk-loaded into an R-tree with
+// sort-tile-recursive packing (each level is sorted into vertical slices by x
+// and then by y within a slice, and consecutive entries are grouped into
+// nodes).  Candidates found in the tree are then checked against the spans
+// themselves, so results are exact.  The index keeps its own copy of the
+// SpanSets; its queries are const and may run concurrently.
+class SpanSetIndex {
+public:
+
+    explicit SpanSetIndex(std::vector<SpanSet> sets, int node_size = 16);
+
+    std::size_t size() const { return _sets.size(); }
+
+    SpanSet const & operator[](std::size_t i) const { return _sets[i]; }
+
+    // Return the indices of the SpanSets that contain a pixel in 'box' (or the
+    // pixel (x, y)), in increasing order.
+    std::vector<std::size_t> query(Box const & box) const;
+    std::vector<std::size_t> query(int x, int y) const;
+
+    // Return all pairs (i, j) with i < j of SpanSets that share a pixel,
+    // sorted.  With threads > 1 (or < 1, for one per core), the entries are
+    // divided among threads.
+    std::vector<std::pair<std::size_t, std::size_t>> overlapping_pairs(int threads = 1) const;
+
+private:
+
+    struct Node {
+        Box bbox;
+        std::uint32_t first;    // range of children in the level below, or
+        std::uint32_t last;     // of _entries for the leaf level
+    };
+
+    // Call visit(i) for every entry whose bbox overlaps 'box'.
+    template <typename Visitor>
+    void search(Box const & box, Visitor && visit) const;
+
+    std::vector<SpanSet> _sets;
+    std::vector<Box> _boxes;                  // bbox of each SpanSet
+    std::vector<std::uint32_t> _entries;      // SpanSet indices in leaf order
+    std::vector<std::vector<Node>> _levels;   // leaves first, root last
+};
+
+
+// Writes a collection of SpanSets to a stream in the archive format described
+// in serialize.cc, one at a time.  close() must be called to write the index
+// that makes the archive readable; it is not called by the destructor, since
+// it can fail.
+class SpanSetArchiveWriter {
+public:
+
+    explicit SpanSetArchiveWriter(std::ostream & stream);
+
+    SpanSetArchiveWriter(SpanSetArchiveWriter const &) = delete;
+    SpanSetArchiveWriter & operator=(SpanSetArchiveWriter const &) = delete;
+
+    void write(SpanSet const & set);
+
+    void close();
+
+private:
+    std::ostream & _stream;
+    std::vector<std::uint64_t> _offsets;
+    bool _closed;
+};
+
+
+// Random-access reader for an archive written by SpanSetArchiveWriter, over
+// memory it does not own (typically a memory-mapped file), which must outlive
+// it.  Only the index is read up front; each SpanSet is decoded when it's
+// requested.  Throws std::invalid_argument if the data isn't an archive.
+class SpanSetArchive {
+public:
+
+    SpanSetArchive(void const * data, std::size_t size);
+
+    std::size_t size() const { return _count; }
+
+    // Decode the i-th SpanSet; throws std::out_of_range for a bad index.
+    SpanSet operator[](std::size_t i) const;
+
+private:
+    std::uint8_t const * _data;
+    std::uint8_t const * _offsets;
+    std::size_t _records_size;
+    std::size_t _count;
+};
+
+
+// Builds the same SpanSet as SpanSet::extract or extract_if from an image
+// supplied a piece at a time, for images too large to hold in memory.
+//
+// Pieces are fed in bands of rows, top to bottom.  Every piece of a band must
+// cover exactly the band's rows and lie to the right of the previous piece; a
+// full-width block of rows is a band with a single piece.  Runs that continue
+// from one piece into the next are joined.  Only the spans of the current band
+// are held until a piece below it arrives; completed bands accumulate until
+// they are taken with pop.  Feeding a piece out of order throws
+// std::invalid_argument.
+class StreamingExtractor {
+public:
+
+    StreamingExtractor();
+
+    template <typename T>
+    void feed(ImageWrapper<T const> const & piece, T value);
+
+    template <typename T, typename Pred>
+    void feed_if(ImageWrapper<T const> const & piece, Pred const & pred);
+
+    // Return the spans of the bands completed since the last call.  Every
+    // row in the result is final, so the results of successive calls can
+    // be concatenated.
+    SpanSet pop();
+
+    // Complete the current band and return everything not yet popped, leaving
+    // the extractor ready for another image.
+    SpanSet finish();
+
+private:
+
+    void complete_band();
+
+    Interval _band;
+    int _next_x0;
+    std::vector<std::vector<Span>> _rows;
+    std::vector<Span> _done;
+    std::vector<Span> _scratch;
+};
+
+
 } // namespace spanops
 
 #endif // !SPANOPS_H_INCLUDED
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#include "stats.h"
+
+namespace spanops {
+
+namespace detail {
+
+std::atomic<bool> stats_on(false);
+
+} // namespace detail
+
+namespace {
+
+std::size_t const n_operations = static_cast<std::size_t>(Operation::N_OPERATIONS);
+
+char const * const names[n_operations] = {
+    "extract",
+    "extract_components",
+    "split",
+    "union",
+    "intersection",
+    "difference",
+    "symmetric_difference",
+    "union_all",
+    "evaluate",
+    "insert",
+    "reduce",
+    "contains",
+    "to_bytes",
+    "from_bytes",
+    "python_conversion",
+};
+
+struct Counters {
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> spans_in;
+    std::atomic<std::uint64_t> spans_out;
+    std::atomic<std::uint64_t> pixels;
+    std::atomic<std::uint64_t> bytes;
+    std::atomic<std::uint64_t> nanoseconds;
+};
+
+Counters counters[n_operations];
+
+struct TraceEvent {
+    Operation op;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration duration;
+    std::size_t thread;
+    std::uint64_t spans_in;
+    std::uint64_t spans_out;
+    std::uint64_t pixels;
+};
+
+// Each thread appends its trace events to its own buffer, so recording one
+// only takes that buffer's lock, which is contended only while the trace is
+// being collected.  trace_mutex guards the list of buffers and the events
+// collected from them, including those from buffers of threads that have
+// since exited; it's always taken before a buffer's lock.
+std::atomic<bool> tracing(false);
+std::mutex trace_mutex;
+std::vector<TraceEvent> trace_events;
+std::chrono::steady_clock::time_point trace_start;
+
+struct TraceBuffer;
+std::vector<TraceBuffer *> trace_buffers;
+
+struct TraceBuffer {
+
+    TraceBuffer() :
+        mutex(), events(),
+        thread(std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000)
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_buffers.push_back(this);
+    }
+
+    TraceBuffer(TraceBuffer const &) = delete;
+    TraceBuffer & operator=(TraceBuffer const &) = delete;
+
+    ~TraceBuffer() {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        collect();
+        trace_buffers.erase(std::find(trace_buffers.begin(), trace_buffers.end(), this));
+    }
+
+    // Move this buffer's events to trace_events; trace_mutex must be held.
+    void collect() {
+        std::lock_guard<std::mutex> lock(mutex);
+        trace_events.insert(trace_events.end(), events.begin(), events.end());
+        events.clear();
+    }
+
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    std::size_t thread;
+};
+
+TraceBuffer & local_trace_buffer() {
+    thread_local TraceBuffer buffer;
+    return buffer;
+}
+
+// Move all threads' events to trace_events; trace_mutex must be held.
+void collect_trace() {
+    for (auto buffer : trace_buffers) {
+        buffer->collect();
+    }
+}
+
+} // anonymous
+
+char const * operation_name(Operation op) {
+    return names[static_cast<std::size_t>(op)];
+}
+
+void enable_stats(bool enabled) {
+    detail::stats_on.store(enabled, std::memory_order_relaxed);
+}
+
+bool stats_enabled() {
+    return detail::stats_on.load(std::memory_order_relaxed);
+}
+
+std::vector<OperationStats> get_stats() {
+    std::vector<OperationStats> result(n_operations);
+    for (std::size_t i = 0; i < n_operations; ++i) {
+        Counters const & c = counters[i];
+        result[i] = OperationStats{
+            c.calls.load(), c.spans_in.load(), c.spans_out.load(),
+            c.pixels.load(), c.bytes.load(), c.nanoseconds.load()
+        };
+    }
+    return result;
+}
+
+void reset_stats() {
+    for (auto & c : counters) {
+        c.calls = 0;
+        c.spans_in = 0;
+        c.spans_out = 0;
+        c.pixels = 0;
+        c.bytes = 0;
+        c.nanoseconds = 0;
+    }
+}
+
+void start_trace() {
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        collect_trace();
+        trace_events.clear();
+        trace_start = std::chrono::steady_clock::now();
+    }
+    tracing = true;
+    enable_stats();
+}
+
+void stop_trace() {
+    tracing = false;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    collect_trace();
+}
+
+void write_trace(std::ostream & stream) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    collect_trace();
+    std::sort(trace_events.begin(), trace_events.end(),
+              [](TraceEvent const & a, TraceEvent const & b) { return a.start < b.start; });
+    std::ios::fmtflags const flags = stream.flags();
+    std::streamsize const precision = stream.precision();
+    stream << std::fixed << std::setprecision(3);
+    stream << "{\"traceEvents\": [";
+    bool first = true;
+    for (auto const & event : trace_events) {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        // Chrome traces are in microseconds, which may be fractional.
+        double const ts = duration_cast<nanoseconds>(event.start - trace_start).count()/1000.0;
+        double const dur = duration_cast<nanoseconds>(event.duration).count()/1000.0;
+        stream << (first ? "\n" : ",\n")
+               << "{\"name\": \"" << operation_name(event.op) << "\", \"cat\": \"spanops\", "
+               << "\"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread << ", "
+               << "\"ts\": " << ts << ", \"dur\": " << dur << ", "
+               << "\"args\": {\"spans_in\": " << event.spans_in
+               << ", \"spans_out\": " << event.spans_out
+               << ", \"pixels\": " << event.pixels << "}}";
+        first = false;
+    }
+    stream << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    stream.flags(flags);
+    stream.precision(precision);
+}
+
+namespace detail {
+
+void OperationTimer::record() {
+    auto const duration = std::chrono::steady_clock::now() - _start;
+    Counters & c = counters[static_cast<std::size_t>(_op)];
+    c.calls.fetch_add(1, std::memory_order_relaxed);
+    c.spans_in.fetch_add(_spans_in, std::memory_order_relaxed);
+    c.spans_out.fetch_add(_spans_out, std::memory_order_relaxed);
+    c.pixels.fetch_add(_pixels, std::memory_order_relaxed);
+    c.bytes.fetch_add(_bytes, std::memory_order_relaxed);
+    c.nanoseconds.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(),
+        std::memory_order_relaxed
+    );
+    if (tracing.load(std::memory_order_relaxed)) {
+        TraceBuffer & buffer = local_trace_buffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back(
+            {_op, _start, duration, buffer.thread, _spans_in, _spans_out, _pixels}
+        );
+    }
+}
+
+} // namespace detail
+} // namespace spanops
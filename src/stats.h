@@ -0,0 +1,131 @@
+#ifndef SPANOPS_STATS_H_INCLUDED
+#define SPANOPS_STATS_H_INCLUDED
+
+// Opt-in performance counters and tracing.
+//
+// Each instrumented operation creates an OperationTimer on entry.  While
+// counting is disabled (the default), that costs one relaxed atomic load and
+// nothing else; while it's enabled, the timer adds the call, its wall time,
+// and whatever sizes the operation reports to that operation's totals when
+// it goes out of scope.  Operations that call other instrumented operations
+// are counted at every level: e.g. a multi-threaded union_all combines its
+// partial unions with |=, which is counted as "union".
+//
+// While a trace is being recorded, each call is also kept as a Chrome trace
+// event, for viewing in chrome://tracing or Perfetto.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace spanops {
+
+enum class Operation {
+    EXTRACT,
+    EXTRACT_COMPONENTS,
+    SPLIT,
+    UNION,
+    INTERSECTION,
+    DIFFERENCE,
+    SYMMETRIC_DIFFERENCE,
+    UNION_ALL,
+    EVALUATE,
+    INSERT,
+    REDUCE,
+    CONTAINS,
+    TO_BYTES,
+    FROM_BYTES,
+    PYTHON_CONVERSION,
+    N_OPERATIONS
+};
+
+// Name of an operation, e.g. "extract", as used in traces and by stats().
+char const * operation_name(Operation op);
+
+// Totals for one operation since counting was enabled or last reset.
+// 'pixels' counts image pixels scanned or written, and 'bytes' the size of
+// the buffers allocated for results.
+struct OperationStats {
+    std::uint64_t calls;
+    std::uint64_t spans_in;
+    std::uint64_t spans_out;
+    std::uint64_t pixels;
+    std::uint64_t bytes;
+    std::uint64_t nanoseconds;
+};
+
+void enable_stats(bool enabled = true);
+bool stats_enabled();
+
+// Totals for every operation, indexed by Operation.
+std::vector<OperationStats> get_stats();
+void reset_stats();
+
+// Record a Chrome trace of every instrumented call from start_trace (which
+// also enables counting, and discards any previous trace) until stop_trace.
+// write_trace writes the events recorded so far as JSON.  Every call is
+// kept in memory (a few dozen bytes each) until the next start_trace, with
+// no limit, so trace only as much as is needed when timing many small
+// operations.
+void start_trace();
+void stop_trace();
+void write_trace(std::ostream & stream);
+
+namespace detail {
+
+extern std::atomic<bool> stats_on;
+
+class OperationTimer {
+public:
+
+    explicit OperationTimer(Operation op) :
+        _active(stats_on.load(std::memory_order_relaxed)), _op(op),
+        _spans_in(0), _spans_out(0), _pixels(0), _bytes(0), _start()
+    {
+        if (_active) {
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    OperationTimer(OperationTimer const &) = delete;
+    OperationTimer & operator=(OperationTimer const &) = delete;
+
+    void spans_in(std::uint64_t n) { _spans_in += n; }
+    void spans_out(std::uint64_t n) { _spans_out += n; }
+    void pixels(std::uint64_t n) { _pixels += n; }
+    void bytes(std::uint64_t n) { _bytes += n; }
+
+    // Count the elements of a result container as output spans, and its
+    // storage as bytes allocated.
+    template <typename Container>
+    void output(Container const & result) {
+        _spans_out += result.size();
+        _bytes += result.capacity()*sizeof(typename Container::value_type);
+    }
+
+    ~OperationTimer() {
+        if (_active) {
+            record();
+        }
+    }
+
+private:
+
+    void record();
+
+    bool _active;
+    Operation _op;
+    std::uint64_t _spans_in;
+    std::uint64_t _spans_out;
+    std::uint64_t _pixels;
+    std::uint64_t _bytes;
+    std::chrono::steady_clock::time_point _start;
+};
+
+} // namespace detail
+} // namespace spanops
+
+#endif // !SPANOPS_STATS_H_INCLUDED
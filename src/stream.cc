@@ -0,0 +1,76 @@
+#include "kernels.h"
+
+namespace spanops {
+
+StreamingExtractor::StreamingExtractor() :
+    _band(), _next_x0(0), _rows(), _done(), _scratch()
+{}
+
+void StreamingExtractor::complete_band() {
+    for (auto & row : _rows) {
+        _done.insert(_done.end(), row.begin(), row.end());
+        row.clear();
+    }
+    _band = Interval();
+}
+
+SpanSet StreamingExtractor::pop() {
+    std::vector<Span> spans;
+    spans.swap(_done);
+    return SpanSet::from_spans(std::move(spans));
+}
+
+SpanSet StreamingExtractor::finish() {
+    complete_band();
+    _rows.clear();
+    _next_x0 = 0;
+    return pop();
+}
+
+#define INSTANTIATE(T)                                                  \
+    template void StreamingExtractor::feed(ImageWrapper<T const> const &, T); \
+    template void StreamingExtractor::feed_if(ImageWrapper<T const> const &, Equal<T> const &)
+
+#define INSTANTIATE_PREDICATE(T, Pred) \
+    template void StreamingExtractor::feed_if(ImageWrapper<T const> const &, Pred<T> const &)
+
+#define INSTANTIATE_COMPARISONS(T)              \
+    INSTANTIATE_PREDICATE(T, Greater);          \
+    INSTANTIATE_PREDICATE(T, GreaterEqual);     \
+    INSTANTIATE_PREDICATE(T, Less);             \
+    INSTANTIATE_PREDICATE(T, LessEqual);        \
+    INSTANTIATE_PREDICATE(T, InRange)
+
+#define INSTANTIATE_BITS(T)                     \
+    INSTANTIATE_PREDICATE(T, AnyBits);          \
+    INSTANTIATE_PREDICATE(T, AllBits)
+
+INSTANTIATE(bool);
+INSTANTIATE(std::uint8_t);
+INSTANTIATE(std::int8_t);
+INSTANTIATE(std::uint16_t);
+INSTANTIATE(std::int16_t);
+INSTANTIATE(std::uint32_t);
+INSTANTIATE(std::int32_t);
+INSTANTIATE(std::uint64_t);
+INSTANTIATE(std::int64_t);
+INSTANTIATE(float);
+INSTANTIATE(double);
+
+INSTANTIATE_COMPARISONS(std::uint8_t);
+INSTANTIATE_COMPARISONS(std::int8_t);
+INSTANTIATE_COMPARISONS(std::uint16_t);
+INSTANTIATE_COMPARISONS(std::int16_t);
+INSTANTIATE_COMPARISONS(std::uint32_t);
+INSTANTIATE_COMPARISONS(std::int32_t);
+INSTANTIATE_COMPARISONS(std::uint64_t);
+INSTANTIATE_COMPARISONS(std::int64_t);
+INSTANTIATE_COMPARISONS(float);
+INSTANTIATE_COMPARISONS(double);
+
+INSTANTIATE_BITS(std::uint8_t);
+INSTANTIATE_BITS(std::uint16_t);
+INSTANTIATE_BITS(std::uint32_t);
+INSTANTIATE_BITS(std::uint64_t);
+
+} // namespace spanops
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+"""Test code for the CompactSpanSet class."""
+from spanops import SpanSet, CompactSpanSet, Box, Interval, Connectivity, InsertMode
+import unittest
+import numpy as np
+
+
+class CompactSpanSetTestCase(unittest.TestCase):
+
+    def test_empty(self):
+        a = CompactSpanSet()
+        self.assertTrue(a.empty)
+        self.assertEqual(len(a), 0)
+        self.assertEqual(a.to_span_set(), SpanSet())
+        self.assertEqual(CompactSpanSet(SpanSet()), a)
+
+    def test_conversion(self):
+        rng = np.random.RandomState(60)
+        s = SpanSet.extract(rng.rand(30, 40) > 0.5, True, x0=-6, y0=4)
+        c = CompactSpanSet(s)
+        self.assertEqual(len(c), len(s))
+        self.assertEqual(c.area, s.area)
+        self.assertEqual(c.bbox, s.bbox)
+        self.assertEqual(c.rows, s.bbox.height)
+        self.assertEqual(sum(c.row_size(y) for y in range(s.bbox.y0, s.bbox.y1 + 1)), len(s))
+        self.assertEqual(c.to_span_set(), s)
+
+    def test_operations(self):
+        rng = np.random.RandomState(61)
+        mask1 = rng.rand(25, 70) > 0.4
+        mask2 = rng.rand(25, 70) > 0.4
+        s1 = SpanSet.extract(mask1, True, x0=2, y0=-3)
+        s2 = SpanSet.extract(mask2, True, x0=2, y0=-3)
+        c1 = CompactSpanSet(s1)
+        c2 = CompactSpanSet(s2)
+        self.assertEqual((c1 & c2).to_span_set(), s1 & s2)
+        self.assertNotEqual(c1, c2)
+        for dtype in (bool, np.uint8, np.int32, np.float64):
+            im = np.zeros(mask1.shape, dtype=dtype)
+            c1.insert(im, np.dtype(dtype).type(1).item(), x0=2, y0=-3)
+            np.testing.assert_equal(im != 0, mask1)
+        for connectivity in (Connectivity.FOUR, Connectivity.EIGHT):
+            self.assertEqual([child.to_span_set() for child in c1.split(connectivity=connectivity)],
+                             s1.split(connectivity=connectivity))
+
+    def test_insert_modes(self):
+        rng = np.random.RandomState(62)
+        mask = rng.rand(12, 70) > 0.5
+        s = SpanSet.extract(mask, True, x0=-3, y0=2) | \
+            SpanSet(Box(x=Interval(min=-10, max=100), y=Interval(min=-5, max=0)))
+        c = CompactSpanSet(s)
+        for dtype in (np.uint8, np.int16, np.uint32, np.int64, np.float32, np.float64):
+            original = rng.randint(0, 8, size=mask.shape).astype(dtype)
+            value = dtype(5).item()
+            modes = [InsertMode.ADD, InsertMode.ASSIGN, InsertMode.MAX]
+            if np.issubdtype(dtype, np.integer):
+                modes.append(InsertMode.OR)
+            for mode in modes:
+                expected = original.copy()
+                s.insert(expected, value, x0=-3, y0=2, mode=mode)
+                for threads in (1, 3):
+                    im = original.copy()
+                    c.insert(im, value, x0=-3, y0=2, mode=mode, threads=threads)
+                    np.testing.assert_equal(im, expected)
+        with self.assertRaises(ValueError):
+            c.insert(np.zeros(mask.shape, dtype=np.float32), 1.0, mode=InsertMode.OR)
+
+
+if __name__ == "__main__":
+    unittest.main()
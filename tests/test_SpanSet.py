@@ -1,6 +1,8 @@
 #!/usr/bin/env python
 """Test code for the SpanSet class."""
-from spanops import SpanSet, Box, Span, Interval
+from spanops import SpanSet, Box, Span, Interval, Connectivity, InsertMode
+import pickle
+import threading
 import unittest
 import numpy as np
 
@@ -43,6 +45,54 @@ class SpanSetTestCase(unittest.TestCase):
         self.assertEqual(s1 & s2, SpanSet(box1 & box2))
         self.assertEqual(s & s2, s2)
         self.assertEqual(s & s1, s1)
+        # A span overlapping several spans on the other side of the
+        # intersection.
+        s3 = SpanSet(Box(x=Interval(min=0, max=2), y=Interval(min=8, max=8))) | \
+            SpanSet(Box(x=Interval(min=5, max=9), y=Interval(min=8, max=8)))
+        s4 = SpanSet(Box(x=Interval(min=0, max=6), y=Interval(min=8, max=8)))
+        expected = SpanSet(Box(x=Interval(min=0, max=2), y=Interval(min=8, max=8))) | \
+            SpanSet(Box(x=Interval(min=5, max=6), y=Interval(min=8, max=8)))
+        self.assertEqual(s3 & s4, expected)
+        self.assertEqual(s4 & s3, expected)
+        # A span that contains the one after it in the merged sequence.
+        s5 = SpanSet(Box(x=Interval(min=1, max=3), y=Interval(min=8, max=8)))
+        self.assertEqual(s4 | s5, s4)
+        self.assertEqual(s5 | s4, s4)
+
+    def test_difference(self):
+        rng = np.random.RandomState(57)
+        mask1 = rng.rand(15, 90) > 0.4
+        mask2 = rng.rand(15, 90) > 0.6
+        s1 = SpanSet.extract(mask1, True, x0=5, y0=-2)
+        s2 = SpanSet.extract(mask2, True, x0=5, y0=-2)
+        self.assertSpansMatch(s1 - s2, mask1 & ~mask2, x0=5, y0=-2)
+        self.assertSpansMatch(s2 - s1, mask2 & ~mask1, x0=5, y0=-2)
+        self.assertSpansMatch(s1 ^ s2, mask1 != mask2, x0=5, y0=-2)
+        self.assertEqual(s1 ^ SpanSet(), s1)
+        self.assertEqual(s1 - SpanSet(), s1)
+        self.assertTrue((s1 - s1).empty)
+        self.assertTrue((s1 ^ s1).empty)
+        s = s1
+        s -= s2
+        self.assertEqual(s, s1 - s2)
+        s = s1
+        s ^= s2
+        self.assertEqual(s, s1 ^ s2)
+
+    def test_union_all(self):
+        rng = np.random.RandomState(58)
+        pieces = [SpanSet.extract(rng.rand(8, 12) > 0.6, True, x0=rng.randint(-20, 20),
+                                  y0=rng.randint(-20, 20))
+                  for _ in range(40)]
+        expected = SpanSet()
+        for piece in pieces:
+            expected = expected | piece
+        self.assertEqual(SpanSet.union_all(pieces), expected)
+        self.assertEqual(SpanSet.union_all(iter(pieces)), expected)
+        for threads in (2, 3, 0):
+            self.assertEqual(SpanSet.union_all(pieces, threads=threads), expected)
+        self.assertEqual(SpanSet.union_all([]), SpanSet())
+        self.assertEqual(SpanSet.union_all(pieces[:1]), pieces[0])
 
     def test_image_ops(self):
         rng = np.random.RandomState(50)
@@ -63,6 +113,292 @@ class SpanSetTestCase(unittest.TestCase):
             child.insert(im_split, n + 1, x0=x0, y0=y0)
         np.testing.assert_equal(original, im_split != 0)
 
+    def test_insert_modes(self):
+        rng = np.random.RandomState(59)
+        mask = rng.rand(12, 70) > 0.5
+        s = SpanSet.extract(mask, True, x0=-3, y0=2) | \
+            SpanSet(Box(x=Interval(min=-10, max=100), y=Interval(min=-5, max=0)))
+        for dtype in (np.uint8, np.int16, np.uint32, np.int64, np.float32, np.float64):
+            original = rng.randint(0, 8, size=mask.shape).astype(dtype)
+            value = dtype(5).item()
+            expected = {
+                InsertMode.ADD: np.where(mask, original + value, original),
+                InsertMode.ASSIGN: np.where(mask, value, original),
+                InsertMode.MAX: np.where(mask, np.maximum(original, value), original),
+            }
+            if np.issubdtype(dtype, np.integer):
+                expected[InsertMode.OR] = np.where(mask, original | value, original)
+            for mode, result in expected.items():
+                for threads in (1, 3):
+                    im = original.copy()
+                    s.insert(im, value, x0=-3, y0=2, mode=mode, threads=threads)
+                    np.testing.assert_equal(im, result.astype(dtype))
+        with self.assertRaises(ValueError):
+            s.insert(np.zeros(mask.shape, dtype=np.float32), 1.0, mode=InsertMode.OR)
+        im = mask.copy()
+        s.insert(im, True, x0=-3, y0=2, mode=InsertMode.ADD)
+        np.testing.assert_equal(im, mask)
+        s.insert(im, False, x0=-3, y0=2, mode=InsertMode.ASSIGN)
+        self.assertFalse(im.any())
+
+    def test_morphology(self):
+        rng = np.random.RandomState(61)
+        mask = np.zeros((40, 40), dtype=bool)
+        mask[5:35, 5:35] = rng.rand(30, 30) > 0.3
+        s = SpanSet.extract(mask, True)
+        box = SpanSet(Box(x=Interval(min=-1, max=1), y=Interval(min=-2, max=2)))
+        circle = SpanSet.circle(2)
+        self.assertEqual(circle.area, 13)
+        for kernel in (box, circle):
+            offsets = [(span.y, x) for span in kernel for x in range(span.x0, span.x1 + 1)]
+            dilated = np.zeros_like(mask)
+            eroded = np.ones_like(mask)
+            for dy, dx in offsets:
+                dilated |= np.roll(np.roll(mask, dy, axis=0), dx, axis=1)
+                eroded &= np.roll(np.roll(mask, -dy, axis=0), -dx, axis=1)
+            self.assertSpansMatch(s.dilated(kernel), dilated)
+            self.assertSpansMatch(s.eroded(kernel), eroded)
+        self.assertTrue(s.dilated(SpanSet()).empty)
+        with self.assertRaises(ValueError):
+            s.eroded(SpanSet())
+
+    def test_reduce(self):
+        rng = np.random.RandomState(60)
+        x0, y0 = (100, -40)
+        image = rng.rand(30, 50) + 0.5
+        mask = rng.rand(30, 50) > 0.6
+        # Part of the SpanSet lies outside the image and must be ignored.
+        s = SpanSet.extract(mask, True, x0=x0, y0=y0) | \
+            SpanSet(Box(x=Interval(min=0, max=10), y=Interval(min=0, max=4)))
+        y, x = np.mgrid[y0:y0 + 30, x0:x0 + 50]
+        v = image[mask]
+        xc = (v*x[mask]).sum()/v.sum()
+        yc = (v*y[mask]).sum()/v.sum()
+        for dtype in (np.float32, np.float64):
+            stats = s.reduce(image.astype(dtype), x0=x0, y0=y0)
+            self.assertEqual(stats.count, mask.sum())
+            self.assertAlmostEqual(stats.sum, v.astype(dtype).sum(), places=3)
+            self.assertAlmostEqual(stats.mean, v.mean(), places=5)
+            self.assertAlmostEqual(stats.min, v.astype(dtype).min())
+            self.assertAlmostEqual(stats.max, v.astype(dtype).max())
+            self.assertAlmostEqual(stats.x, xc, places=4)
+            self.assertAlmostEqual(stats.y, yc, places=4)
+            self.assertAlmostEqual(stats.xx, (v*(x[mask] - xc)**2).sum()/v.sum(), places=4)
+            self.assertAlmostEqual(stats.xy, (v*(x[mask] - xc)*(y[mask] - yc)).sum()/v.sum(),
+                                   places=4)
+            self.assertAlmostEqual(stats.yy, (v*(y[mask] - yc)**2).sum()/v.sum(), places=4)
+        stats = SpanSet().reduce(image)
+        self.assertEqual(stats.count, 0)
+        self.assertTrue(np.isnan(stats.min))
+        self.assertTrue(np.isnan(stats.x))
+        counts = rng.randint(0, 10, size=(30, 50)).astype(np.int32)
+        children = SpanSet.extract(mask, True).split()
+        for threads in (1, 3):
+            results = SpanSet.reduce_all(children, counts, threads=threads)
+            self.assertEqual([r.sum for r in results], [c.reduce(counts).sum for c in children])
+
+    def test_extract_dtypes(self):
+        # Rows wider than a vector register, with ragged tails, so both the
+        # vectorized and scalar paths of the run detection are exercised.
+        rng = np.random.RandomState(51)
+        labels = rng.randint(0, 3, size=(6, 203))
+        for dtype in (bool, np.uint8, np.int8, np.uint16, np.int16, np.uint32, np.int32,
+                      np.uint64, np.int64, np.float32, np.float64):
+            array = labels.astype(dtype)
+            one = array.dtype.type(1).item()
+            s = SpanSet.extract(array, one, x0=3, y0=-1)
+            im = np.zeros(array.shape, dtype=dtype)
+            s.insert(im, one, x0=3, y0=-1)
+            np.testing.assert_equal(im != 0, array == one)
+            for span, next_span in zip(list(s), list(s)[1:]):
+                if span.y == next_span.y:
+                    self.assertGreater(next_span.x0, span.x1 + 1)
+
+    def assertSpansMatch(self, spans, mask, x0=0, y0=0):
+        im = np.zeros(mask.shape, dtype=bool)
+        spans.insert(im, True, x0=x0, y0=y0)
+        np.testing.assert_equal(im, mask)
+        self.assertEqual(spans, SpanSet.extract(mask, True, x0=x0, y0=y0))
+
+    def test_extract_predicates(self):
+        rng = np.random.RandomState(52)
+        image = rng.randn(9, 150)
+        for dtype in (np.float32, np.float64):
+            array = image.astype(dtype)
+            self.assertSpansMatch(SpanSet.extract_greater(array, 0.5), array > 0.5)
+            self.assertSpansMatch(SpanSet.extract_greater_equal(array, 0.5), array >= 0.5)
+            self.assertSpansMatch(SpanSet.extract_less(array, -0.5), array < -0.5)
+            self.assertSpansMatch(SpanSet.extract_less_equal(array, -0.5), array <= -0.5)
+            self.assertSpansMatch(SpanSet.extract_in_range(array, -0.5, 0.5, x0=4, y0=2),
+                                  (array >= -0.5) & (array <= 0.5), x0=4, y0=2)
+        for dtype in (np.int16, np.uint32, np.int64, np.uint64):
+            array = rng.randint(0, 100, size=(9, 150)).astype(dtype)
+            self.assertSpansMatch(SpanSet.extract_greater(array, 60), array > 60)
+            self.assertSpansMatch(SpanSet.extract_less_equal(array, 20), array <= 20)
+            self.assertSpansMatch(SpanSet.extract_in_range(array, 30, 70),
+                                  (array >= 30) & (array <= 70))
+        for dtype in (np.uint8, np.uint16, np.uint32, np.uint64):
+            array = rng.randint(0, 256, size=(9, 150)).astype(dtype)
+            self.assertSpansMatch(SpanSet.extract_any_bits(array, 0x5), (array & 0x5) != 0)
+            self.assertSpansMatch(SpanSet.extract_all_bits(array, 0x5), (array & 0x5) == 0x5)
+
+
+    def test_extract_labels(self):
+        rng = np.random.RandomState(53)
+        for dtype in (np.uint8, np.int32, np.int64):
+            array = rng.randint(0, 6, size=(12, 80)).astype(dtype)
+            labels = SpanSet.extract_labels(array, x0=-3, y0=7)
+            self.assertEqual(sorted(labels.keys()), list(range(6)))
+            for label, spans in labels.items():
+                self.assertEqual(spans, SpanSet.extract(array, label, x0=-3, y0=7))
+            labels = SpanSet.extract_labels(array, background=0)
+            self.assertEqual(sorted(labels.keys()), list(range(1, 6)))
+
+
+    def test_extract_components(self):
+        rng = np.random.RandomState(23)
+        image = rng.rand(60, 70).astype(np.float32)
+        for connectivity in (Connectivity.FOUR, Connectivity.EIGHT):
+            expected = SpanSet.extract_greater(image, 0.6, x0=4, y0=-2).split(connectivity)
+            components = SpanSet.extract_components_greater(image, 0.6, connectivity, x0=4, y0=-2)
+            self.assertEqual(components, expected)
+            components, labels = SpanSet.extract_components_greater(
+                image, 0.6, connectivity, x0=4, y0=-2, labels=True
+            )
+            self.assertEqual(components, expected)
+            self.assertEqual(labels.dtype, np.int32)
+            self.assertEqual(labels.shape, image.shape)
+            np.testing.assert_array_equal(labels > 0, image > 0.6)
+            for n, component in enumerate(components):
+                self.assertSpansMatch(component, labels == n + 1, x0=4, y0=-2)
+        mask = image > 0.5
+        self.assertEqual(SpanSet.extract_components(mask, True), SpanSet.extract(mask, True).split())
+
+    def test_split_connectivity(self):
+        # Two boxes that only touch diagonally.
+        s = SpanSet(Box(x=Interval(min=0, max=2), y=Interval(min=0, max=2))) | \
+            SpanSet(Box(x=Interval(min=3, max=5), y=Interval(min=3, max=5)))
+        self.assertEqual(len(s.split()), 2)
+        self.assertEqual(len(s.split(connectivity=Connectivity.FOUR)), 2)
+        self.assertEqual(s.split(connectivity=Connectivity.EIGHT), [s])
+        # Rows that are not adjacent are never connected.
+        s = SpanSet(Box(x=Interval(min=0, max=2), y=Interval(min=0, max=0))) | \
+            SpanSet(Box(x=Interval(min=0, max=2), y=Interval(min=2, max=2)))
+        self.assertEqual(len(s.split(connectivity=Connectivity.EIGHT)), 2)
+
+    def test_split_large_component(self):
+        # A serpentine with one span per row used to overflow the stack.
+        array = np.zeros((20001, 3), dtype=bool)
+        array[:, 1] = True
+        array[::2, 0] = True
+        s = SpanSet.extract(array, True)
+        self.assertEqual(s.split(), [s])
+
+
+    def test_split_threads(self):
+        rng = np.random.RandomState(54)
+        s = SpanSet.extract(rng.rand(300, 200) > 0.55, True)
+        for connectivity in (Connectivity.FOUR, Connectivity.EIGHT):
+            serial = s.split(connectivity=connectivity)
+            for threads in (2, 5, 0):
+                self.assertEqual(s.split(connectivity=connectivity, threads=threads), serial)
+
+    def test_extract_threads(self):
+        rng = np.random.RandomState(58)
+        image = rng.rand(301, 150)
+        mask = image > 0.5
+        for threads in (2, 5, 0):
+            self.assertEqual(SpanSet.extract(mask, True, x0=-3, y0=9, threads=threads),
+                             SpanSet.extract(mask, True, x0=-3, y0=9))
+            self.assertEqual(SpanSet.extract_greater(image, 0.5, threads=threads),
+                             SpanSet.extract_greater(image, 0.5))
+
+
+    def test_threads(self):
+        # Bindings release the GIL, and a const SpanSet may be shared.
+        rng = np.random.RandomState(55)
+        images = [rng.rand(200, 200) > 0.5 for _ in range(8)]
+        expected = [SpanSet.extract(image, True) for image in images]
+        shared = expected[0]
+        results = [None]*len(images)
+
+        def work(n):
+            s = SpanSet.extract(images[n], True)
+            results[n] = (s, len((s | shared).split()), len((s & shared).split()))
+
+        threads = [threading.Thread(target=work, args=(n,)) for n in range(len(images))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for s, result in zip(expected, results):
+            self.assertEqual(result, (s, len((s | shared).split()), len((s & shared).split())))
+
+
+    def test_array_conversion(self):
+        rng = np.random.RandomState(56)
+        s = SpanSet.extract(rng.rand(20, 30) > 0.5, True, x0=-4, y0=3)
+        array = s.as_array()
+        self.assertEqual(array.shape, (len(s), 3))
+        self.assertEqual(array.dtype, np.int32)
+        self.assertFalse(array.flags.writeable)
+        np.testing.assert_equal(array, [(span.y, span.x0, span.x1) for span in s])
+        self.assertEqual(SpanSet.from_array(array), s)
+        self.assertEqual(SpanSet.from_array(array.astype(np.int64)), s)
+        self.assertEqual(SpanSet().as_array().shape, (0, 3))
+        # The view keeps its SpanSet alive, and in-place operators rebind
+        # rather than modify it.
+        del s
+        t = SpanSet.from_array(array)
+        u = t
+        t |= SpanSet(Box(x=Interval(min=-50, max=-40), y=Interval(min=0, max=40)))
+        self.assertEqual(u, SpanSet.from_array(array))
+        self.assertNotEqual(t, u)
+        with self.assertRaises(ValueError):
+            SpanSet.from_array(array[::-1])
+        with self.assertRaises(ValueError):
+            SpanSet.from_array(np.array([[0, 1, 4], [0, 3, 6]], dtype=np.int32))
+        with self.assertRaises(ValueError):
+            SpanSet.from_array(np.array([[0, 4, 1]], dtype=np.int32))
+
+    def test_contains(self):
+        rng = np.random.RandomState(22)
+        mask = rng.rand(30, 40) > 0.5
+        s = SpanSet.extract(mask, True, x0=-3, y0=5)
+        ys, xs = np.mgrid[0:30, 0:40]
+        np.testing.assert_array_equal(s.contains(xs - 3, ys + 5), mask)
+        order = rng.permutation(mask.size)
+        np.testing.assert_array_equal(s.contains((xs - 3).ravel()[order], (ys + 5).ravel()[order]),
+                                      mask.ravel()[order])
+        np.testing.assert_array_equal(s.contains([-4, -3], [5, 5]), [False, mask[0, 0]])
+        self.assertEqual(s.contains(-3, 5), mask[0, 0])
+        for dtype in (np.int64, np.float64):
+            result = s.contains(np.array([-3], dtype=dtype), np.array([5], dtype=dtype))
+            self.assertIsInstance(result, np.ndarray)
+            np.testing.assert_array_equal(result, [mask[0, 0]])
+        with self.assertRaises(ValueError):
+            s.contains(np.zeros(3), np.zeros(4))
+        part = SpanSet.extract(mask & (rng.rand(30, 40) > 0.5), True, x0=-3, y0=5)
+        self.assertTrue(s.contains(part))
+        self.assertTrue(s.contains(SpanSet()))
+        self.assertFalse(part.contains(s))
+
+    def test_serialization(self):
+        rng = np.random.RandomState(57)
+        s = SpanSet.extract(rng.rand(40, 30) > 0.5, True, x0=-12, y0=-7)
+        for t in (s, SpanSet()):
+            data = t.to_bytes()
+            self.assertIsInstance(data, bytes)
+            self.assertEqual(SpanSet.from_bytes(data), t)
+            self.assertEqual(SpanSet.from_bytes(bytearray(data)), t)
+            self.assertEqual(pickle.loads(pickle.dumps(t)), t)
+        data = s.to_bytes()
+        self.assertLess(len(data), 4*len(s) + 8)
+        with self.assertRaises(ValueError):
+            SpanSet.from_bytes(data[:-1])
+        with self.assertRaises(ValueError):
+            SpanSet.from_bytes(data + b"\0")
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,55 @@
+#!/usr/bin/env python
+"""Test code for the SpanSetArchive class."""
+from spanops import SpanSet, SpanSetArchive
+import mmap
+import os
+import shutil
+import tempfile
+import unittest
+import numpy as np
+
+
+class SpanSetArchiveTestCase(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(80)
+        self.sets = [SpanSet()]
+        for n in range(100):
+            width, height = rng.randint(1, 30, size=2)
+            x0, y0 = rng.randint(-500, 500, size=2)
+            self.sets.append(SpanSet.extract(rng.rand(height, width) > 0.5, True, x0=x0, y0=y0))
+        self.directory = tempfile.mkdtemp()
+        self.path = os.path.join(self.directory, "sets.spanarc")
+
+    def tearDown(self):
+        shutil.rmtree(self.directory)
+
+    def test_mmap(self):
+        SpanSetArchive.write(self.path, (s for s in self.sets))
+        with open(self.path, "rb") as f:
+            with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+                archive = SpanSetArchive(m)
+                self.assertEqual(len(archive), len(self.sets))
+                for i in (0, 1, 50, len(self.sets) - 1, -1):
+                    self.assertEqual(archive[i], self.sets[i])
+                self.assertEqual(list(archive), self.sets)
+                with self.assertRaises(IndexError):
+                    archive[len(self.sets)]
+                del archive
+
+    def test_bytes(self):
+        SpanSetArchive.write(self.path, [])
+        with open(self.path, "rb") as f:
+            self.assertEqual(len(SpanSetArchive(f.read())), 0)
+        SpanSetArchive.write(self.path, self.sets)
+        with open(self.path, "rb") as f:
+            data = f.read()
+        self.assertEqual(list(SpanSetArchive(data)), self.sets)
+        with self.assertRaises(ValueError):
+            SpanSetArchive(data[:-1])
+        with self.assertRaises(ValueError):
+            SpanSetArchive(b"not an archive")
+
+
+if __name__ == "__main__":
+    unittest.main()
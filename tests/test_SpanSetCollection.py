@@ -0,0 +1,50 @@
+#!/usr/bin/env python
+"""Test code for the SpanSetCollection class."""
+from spanops import SpanSet, SpanSetCollection, Connectivity
+import unittest
+import numpy as np
+
+
+class SpanSetCollectionTestCase(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(24)
+        self.spans = SpanSet.extract(rng.rand(80, 90) > 0.6, True, x0=3, y0=-7)
+
+    def test_split_collection(self):
+        for connectivity in (Connectivity.FOUR, Connectivity.EIGHT):
+            expected = self.spans.split(connectivity)
+            for threads in (1, 3):
+                collection = self.spans.split_collection(connectivity, threads=threads)
+                self.assertEqual(len(collection), len(expected))
+                self.assertEqual(list(collection), expected)
+                self.assertEqual(collection[-1], expected[-1])
+                self.assertEqual(collection.to_list(threads=threads), expected)
+                np.testing.assert_array_equal(collection.areas, [s.area for s in expected])
+                with self.assertRaises(IndexError):
+                    collection[len(expected)]
+
+    def test_as_arrays(self):
+        collection = self.spans.split_collection()
+        spans, offsets = collection.as_arrays()
+        self.assertEqual(spans.shape, (len(self.spans), 3))
+        self.assertEqual(len(offsets), len(collection) + 1)
+        self.assertEqual(offsets[0], 0)
+        self.assertEqual(offsets[-1], len(self.spans))
+        for n, component in enumerate(collection):
+            np.testing.assert_array_equal(spans[offsets[n]:offsets[n + 1]], component.as_array())
+        with self.assertRaises(ValueError):
+            spans[0, 0] = 1
+        del collection
+        self.assertEqual(spans.sum(axis=0)[0], self.spans.as_array().sum(axis=0)[0])
+
+    def test_empty(self):
+        self.assertEqual(len(SpanSetCollection()), 0)
+        self.assertEqual(len(SpanSet().split_collection()), 0)
+        spans, offsets = SpanSetCollection().as_arrays()
+        self.assertEqual(spans.shape, (0, 3))
+        np.testing.assert_array_equal(offsets, [0])
+
+
+if __name__ == "__main__":
+    unittest.main()
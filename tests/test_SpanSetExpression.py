@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+"""Test code for the SpanSetExpression class."""
+from spanops import SpanSet, SpanSetExpression
+import threading
+import unittest
+import numpy as np
+
+
+class SpanSetExpressionTestCase(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(21)
+        self.sets = [
+            SpanSet.extract(rng.rand(40, 50) > 0.6, True, x0=rng.randint(-10, 10), y0=rng.randint(-10, 10))
+            for n in range(4)
+        ]
+
+    def assertSamePixels(self, a, b):
+        self.assertTrue((a ^ b).empty)
+        self.assertEqual(a.area, b.area)
+
+    def test_operators(self):
+        a, b, c, d = self.sets
+        self.assertSamePixels((a.lazy() | b).evaluate(), a | b)
+        self.assertSamePixels((a.lazy() & b).evaluate(), a & b)
+        self.assertSamePixels((a.lazy() - b).evaluate(), a - b)
+        self.assertSamePixels((a.lazy() ^ b).evaluate(), a ^ b)
+        self.assertSamePixels((a - b.lazy()).evaluate(), a - b)
+        self.assertSamePixels((((a.lazy() | b) & c) - d).evaluate(), ((a | b) & c) - d)
+        self.assertSamePixels((a.lazy() & (SpanSetExpression(b) ^ c)).evaluate(), a & (b ^ c))
+        self.assertTrue((a.lazy() - a).evaluate().empty)
+        self.assertSamePixels(SpanSetExpression(a).evaluate(), a)
+
+    def test_joined_spans(self):
+        a = SpanSet.extract(np.array([[1, 1, 0, 0]], dtype=np.uint8), 1)
+        b = SpanSet.extract(np.array([[0, 0, 1, 1]], dtype=np.uint8), 1)
+        self.assertEqual(len(a | b), 2)
+        self.assertEqual(len((a.lazy() | b).evaluate()), 1)
+
+    def test_lifetime(self):
+        a, b = self.sets[:2]
+        expression = a.lazy() | b.lazy()
+        del a, b
+        del self.sets
+        first = expression.evaluate()
+        self.assertEqual(expression.evaluate(), first)
+
+    def test_threads(self):
+        a, b, c, d = self.sets
+        expression = ((a.lazy() | b) & c) - d
+        expected = ((a | b) & c) - d
+        results = [None]*8
+
+        def run(i):
+            results[i] = expression.evaluate()
+
+        threads = [threading.Thread(target=run, args=(i,)) for i in range(len(results))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for result in results:
+            self.assertSamePixels(result, expected)
+            self.assertEqual(result, results[0])
+
+    def test_invalid(self):
+        with self.assertRaises(TypeError):
+            self.sets[0].lazy() | 5
+        with self.assertRaises(TypeError):
+            SpanSetExpression(5)
+
+
+if __name__ == "__main__":
+    unittest.main()
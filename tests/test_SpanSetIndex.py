@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+"""Test code for the SpanSetIndex class."""
+from spanops import SpanSet, SpanSetIndex, Box, Interval
+import unittest
+import numpy as np
+
+
+class SpanSetIndexTestCase(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(70)
+        self.sets = []
+        for n in range(300):
+            width, height = rng.randint(1, 10, size=2)
+            x0, y0 = rng.randint(0, 150, size=2)
+            self.sets.append(SpanSet.extract(rng.rand(height, width) > 0.4, True, x0=x0, y0=y0))
+        self.sets.append(SpanSet())
+        self.index = SpanSetIndex(self.sets, node_size=4)
+
+    def test_queries(self):
+        self.assertEqual(len(self.index), len(self.sets))
+        self.assertEqual(self.index[7], self.sets[7])
+        self.assertEqual(self.index[-1], self.sets[-1])
+        self.assertEqual(self.index[-2], self.sets[-2])
+        self.assertEqual(self.index[-len(self.sets)], self.sets[0])
+        with self.assertRaises(IndexError):
+            self.index[len(self.sets)]
+        with self.assertRaises(IndexError):
+            self.index[-len(self.sets) - 1]
+        rng = np.random.RandomState(71)
+        for _ in range(50):
+            x, y = rng.randint(0, 160, size=2)
+            box = Box(x=Interval(min=x, max=x + rng.randint(0, 15)),
+                      y=Interval(min=y, max=y + rng.randint(0, 15)))
+            expected = [i for i, s in enumerate(self.sets) if not (s & SpanSet(box)).empty]
+            self.assertEqual(self.index.query(box), expected)
+            expected = [i for i, s in enumerate(self.sets)
+                        if any(span.y == y and span.x0 <= x <= span.x1 for span in s)]
+            self.assertEqual(self.index.query(x, y), expected)
+            self.assertEqual([self.sets[i].contains(x, y) for i in expected], [True]*len(expected))
+
+    def test_overlapping_pairs(self):
+        expected = [(i, j) for i in range(len(self.sets)) for j in range(i + 1, len(self.sets))
+                    if not (self.sets[i] & self.sets[j]).empty]
+        for threads in (1, 3):
+            pairs = self.index.overlapping_pairs(threads=threads)
+            self.assertEqual(pairs.shape, (len(expected), 2))
+            self.assertEqual([tuple(p) for p in pairs.tolist()], expected)
+            for i, j in expected:
+                self.assertTrue(self.sets[i].overlaps(self.sets[j]))
+
+
+if __name__ == "__main__":
+    unittest.main()
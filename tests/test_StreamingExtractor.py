@@ -0,0 +1,49 @@
+#!/usr/bin/env python
+"""Test code for the StreamingExtractor class."""
+from spanops import SpanSet, StreamingExtractor
+import unittest
+import numpy as np
+
+
+class StreamingExtractorTestCase(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.RandomState(90)
+        self.image = rng.rand(97, 203).astype(np.float32)
+        self.x0 = -20
+        self.y0 = 35
+        self.expected = SpanSet.extract_greater(self.image, 0.4, x0=self.x0, y0=self.y0)
+
+    def test_row_blocks(self):
+        extractor = StreamingExtractor()
+        spans = []
+        for y in range(0, self.image.shape[0], 10):
+            extractor.feed_greater(self.image[y:y + 10], 0.4, x0=self.x0, y0=self.y0 + y)
+            spans.extend(extractor.pop())
+        spans.extend(extractor.finish())
+        self.assertEqual(list(self.expected), spans)
+
+    def test_tiles(self):
+        extractor = StreamingExtractor()
+        for y in range(0, self.image.shape[0], 16):
+            for x in range(0, self.image.shape[1], 37):
+                extractor.feed_greater(self.image[y:y + 16, x:x + 37], 0.4,
+                                       x0=self.x0 + x, y0=self.y0 + y)
+        self.assertEqual(extractor.finish(), self.expected)
+        # The extractor can be reused, and bool images use feed.
+        mask = self.image > 0.4
+        extractor.feed(mask[:50], True, x0=self.x0, y0=self.y0)
+        extractor.feed(mask[50:], True, x0=self.x0, y0=self.y0 + 50)
+        self.assertEqual(extractor.finish(), self.expected)
+
+    def test_order(self):
+        extractor = StreamingExtractor()
+        extractor.feed_greater(self.image[10:20, 50:], 0.4)
+        with self.assertRaises(ValueError):
+            extractor.feed_greater(self.image[10:20, :50], 0.4)
+        with self.assertRaises(ValueError):
+            extractor.feed_greater(self.image[15:25], 0.4, y0=5)
+
+
+if __name__ == "__main__":
+    unittest.main()
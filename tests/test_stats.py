@@ -0,0 +1,110 @@
+#!/usr/bin/env python
+"""Test code for the performance counters and tracing."""
+import spanops
+from spanops import SpanSet
+import json
+import os
+import shutil
+import tempfile
+import threading
+import unittest
+import numpy as np
+
+
+class StatsTestCase(unittest.TestCase):
+
+    def setUp(self):
+        spanops.enable_stats(False)
+        spanops.reset_stats()
+        rng = np.random.RandomState(25)
+        self.image = rng.rand(50, 60) > 0.5
+
+    def tearDown(self):
+        spanops.enable_stats(False)
+        spanops.reset_stats()
+
+    def test_disabled(self):
+        SpanSet.extract(self.image, True)
+        self.assertFalse(spanops.stats_enabled())
+        self.assertEqual(spanops.stats()["extract"]["calls"], 0)
+
+    def test_counters(self):
+        spanops.enable_stats()
+        a = SpanSet.extract(self.image, True)
+        b = SpanSet.extract(self.image, False)
+        c = a | b
+        components = c.split()
+        stats = spanops.stats()
+        self.assertEqual(stats["extract"]["calls"], 2)
+        self.assertEqual(stats["extract"]["pixels"], 2*self.image.size)
+        self.assertEqual(stats["extract"]["spans_out"], len(a) + len(b))
+        self.assertGreaterEqual(stats["extract"]["bytes"], 12*(len(a) + len(b)))
+        self.assertGreater(stats["extract"]["seconds"], 0.0)
+        self.assertEqual(stats["union"]["spans_in"], len(a) + len(b))
+        self.assertEqual(stats["split"]["spans_out"], len(c))
+        self.assertEqual(stats["python_conversion"]["spans_in"], len(components))
+        spanops.reset_stats()
+        image = np.zeros((20, 30), dtype=np.int32)
+        a.insert(image, 1, x0=-10, threads=3)
+        self.assertEqual(spanops.stats()["insert"]["pixels"], image.sum())
+        spanops.reset_stats()
+        self.assertEqual(spanops.stats()["extract"]["calls"], 0)
+
+    def test_nested(self):
+        sets = [SpanSet.extract(self.image, True, y0=100*i) for i in range(8)]
+        spanops.enable_stats()
+        result = SpanSet.union_all(sets, threads=4)
+        stats = spanops.stats()
+        self.assertEqual(stats["union_all"]["calls"], 1)
+        self.assertEqual(stats["union_all"]["spans_out"], len(result))
+        self.assertGreater(stats["union"]["calls"], 0)
+
+    def test_trace(self):
+        directory = tempfile.mkdtemp()
+        try:
+            path = os.path.join(directory, "trace.json")
+            spanops.start_trace()
+            a = SpanSet.extract(self.image, True)
+            a.split()
+            spanops.stop_trace(path)
+            a.split()
+            with open(path) as f:
+                trace = json.load(f)
+            names = [event["name"] for event in trace["traceEvents"]]
+            self.assertEqual(names.count("extract"), 1)
+            self.assertEqual(names.count("split"), 1)
+            for event in trace["traceEvents"]:
+                self.assertEqual(event["ph"], "X")
+                self.assertGreaterEqual(event["dur"], 0.0)
+        finally:
+            shutil.rmtree(directory)
+
+    def test_trace_threads(self):
+        a = SpanSet.extract(self.image, True)
+
+        def work():
+            for _ in range(100):
+                a & a
+
+        directory = tempfile.mkdtemp()
+        try:
+            path = os.path.join(directory, "trace.json")
+            spanops.start_trace()
+            threads = [threading.Thread(target=work) for _ in range(4)]
+            for thread in threads:
+                thread.start()
+            for thread in threads:
+                thread.join()
+            spanops.stop_trace(path)
+            with open(path) as f:
+                trace = json.load(f)
+            names = [event["name"] for event in trace["traceEvents"]]
+            self.assertEqual(names.count("intersection"), 400)
+            starts = [event["ts"] for event in trace["traceEvents"]]
+            self.assertEqual(starts, sorted(starts))
+        finally:
+            shutil.rmtree(directory)
+
+
+if __name__ == "__main__":
+    unittest.main()